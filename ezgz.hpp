@@ -13,6 +13,27 @@
 #include <functional>
 #include <variant>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <tuple>
+#include <limits>
+#include <future>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+#if __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && __has_include(<fcntl.h>) && __has_include(<unistd.h>)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define EZGZ_HAS_MMAP
+#endif
 
 namespace EzGz {
 
@@ -27,6 +48,8 @@ concept DecompressionSettings = std::constructible_from<typename T::Checksum> &&
 };
 
 struct NoChecksum { // Noop
+	NoChecksum() = default;
+	NoChecksum(uint32_t) {}
 	int operator() () { return 0; }
 	int operator() (std::span<const uint8_t>) { return 0; }
 };
@@ -37,6 +60,8 @@ struct MinDecompressionSettings {
 	constexpr static int inputBufferSize = 33000;
 	using Checksum = NoChecksum;
 	constexpr static bool verifyChecksum = false;
+	constexpr static bool runtimeBufferSizes = false; // If true, the sizes above are only defaults and buffers are allocated
+	constexpr static bool circularOutputBuffer = false; // If true, the last 32 kiB are kept in a ring, maxOutputBufferSize must be between 32 and 64 kiB
 };
 
 namespace Detail {
@@ -71,12 +96,40 @@ template <>
 struct CrcLookupTable<0> {
 	constexpr static const std::array<uint32_t, 256> data = basicCrc32LookupTable;
 };
+
+// Product of polynomials modulo the CRC-32 polynomial, in the reflected bit order where the highest bit is x^0
+constexpr uint32_t multiplyCrc32Polynomials(uint32_t first, uint32_t second) {
+	uint32_t product = 0;
+	for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+		if (first & bit) {
+			product ^= second;
+		}
+		second = (second & 1) ? (second >> 1) ^ 0xedb88320u : second >> 1;
+	}
+	return product;
+}
+
+// Checksum of two pieces of data from their checksums, CRC-32 of the first one is shifted by the second one's size (as in zlib's crc32_combine)
+constexpr uint32_t combineCrc32(uint32_t first, uint32_t second, int64_t secondSize) {
+	uint32_t power = 1u << 30; // x^1, squared to get x^(2^n)
+	uint32_t shift = 1u << 31; // x^(8 * secondSize)
+	for (uint64_t bits = uint64_t(secondSize) * 8; bits > 0; bits >>= 1) {
+		if (bits & 1) {
+			shift = multiplyCrc32Polynomials(power, shift);
+		}
+		power = multiplyCrc32Polynomials(power, power);
+	}
+	return multiplyCrc32Polynomials(shift, first) ^ second;
+}
 }
 
 class LightCrc32 {
 	uint32_t state = 0xffffffffu;
 
 public:
+	LightCrc32() = default;
+	LightCrc32(uint32_t resumed) : state(~resumed) {} // Continues after data with this checksum
+	static uint32_t combine(uint32_t first, uint32_t second, int64_t secondSize) { return Detail::combineCrc32(first, second, secondSize); }
 	uint32_t operator() () { return ~state; }
 	uint32_t operator() (std::span<const uint8_t> input) {
 		for (auto it : input) {
@@ -92,6 +145,9 @@ class FastCrc32 {
 	uint32_t state = 0xffffffffu;
 
 public:
+	FastCrc32() = default;
+	FastCrc32(uint32_t resumed) : state(~resumed) {} // Continues after data with this checksum
+	static uint32_t combine(uint32_t first, uint32_t second, int64_t secondSize) { return Detail::combineCrc32(first, second, secondSize); }
 	uint32_t operator() () { return ~state; }
 	uint32_t operator() (std::span<const uint8_t> input) {
 		constexpr int chunkSize = 16;
@@ -134,6 +190,40 @@ public:
 	}
 };
 
+// Checksum used by zlib streams
+class Adler32 {
+	uint32_t sum = 1;
+	uint32_t sumOfSums = 0;
+
+public:
+	Adler32() = default;
+	Adler32(uint32_t resumed) : sum(resumed & 0xffff), sumOfSums(resumed >> 16) {} // Continues after data with this checksum
+
+	// Checksum of two pieces of data from their checksums, each byte of the second one adds the first one's sum to the sum of sums
+	static uint32_t combine(uint32_t first, uint32_t second, int64_t secondSize) {
+		constexpr uint64_t modulo = 65521;
+		uint64_t sum = ((first & 0xffff) + (second & 0xffff) + modulo - 1) % modulo;
+		uint64_t sumOfSums = ((first >> 16) + (second >> 16) + (first & 0xffff) * (uint64_t(secondSize) % modulo) + modulo - uint64_t(secondSize) % modulo) % modulo;
+		return uint32_t((sumOfSums << 16) | sum);
+	}
+	uint32_t operator() () { return (sumOfSums << 16) | sum; }
+	uint32_t operator() (std::span<const uint8_t> input) {
+		constexpr uint32_t modulo = 65521;
+		constexpr size_t maxDeferredBytes = 5552; // The most bytes that can be summed before the modulo without overflowing
+		while (!input.empty()) {
+			size_t summing = std::min(input.size(), maxDeferredBytes);
+			for (size_t i = 0; i < summing; i++) {
+				sum += input[i];
+				sumOfSums += sum;
+			}
+			sum %= modulo;
+			sumOfSums %= modulo;
+			input = input.subspan(summing);
+		}
+		return (*this)();
+	}
+};
+
 struct DefaultDecompressionSettings : MinDecompressionSettings {
 	constexpr static int maxOutputBufferSize = 100000;
 	constexpr static int inputBufferSize = 100000;
@@ -141,32 +231,286 @@ struct DefaultDecompressionSettings : MinDecompressionSettings {
 	constexpr static bool verifyChecksum = true;
 };
 
+// Uses as little memory as possible, for running many decompressions at once, slower because of small batches
+struct SmallDecompressionSettings : MinDecompressionSettings {
+	constexpr static int maxOutputBufferSize = 32768 + 1024; // Up to 1 kiB can be kept before each batch
+	constexpr static int minOutputBufferSize = 32768;
+	constexpr static int inputBufferSize = 512;
+	using Checksum = LightCrc32;
+	constexpr static bool verifyChecksum = true;
+	constexpr static bool circularOutputBuffer = true;
+};
+
+// Counts how many times each byte value occurs in the decompressed data, usable as an observer in ChecksumWithObservers
+struct ByteFrequency {
+	std::array<uint64_t, 256> counts = {};
+
+	void operator() (std::span<const uint8_t> input) {
+		// Separate tables for adjacent bytes avoid waiting for the previous increment if they are equal
+		std::array<std::array<uint32_t, 256>, 4> partial = {};
+		const uint8_t* bytes = input.data();
+		const size_t size = input.size();
+		size_t position = 0;
+		for ( ; position + 4 <= size; position += 4) {
+			partial[0][bytes[position]]++;
+			partial[1][bytes[position + 1]]++;
+			partial[2][bytes[position + 2]]++;
+			partial[3][bytes[position + 3]]++;
+		}
+		for ( ; position < size; position++) {
+			partial[0][bytes[position]]++;
+		}
+		for (int i = 0; i < 256; i++) {
+			counts[i] += partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+		}
+	}
+
+	uint64_t total() const {
+		return std::accumulate(counts.begin(), counts.end(), uint64_t(0));
+	}
+};
+
+// Passes every batch of decompressed data to the checksum and to several other observers while it's still in cache
+// The result of the checksum is used to verify the data, the other observers' results are ignored
+template <typename Checksum, typename... Observers>
+class ChecksumWithObservers {
+	std::tuple<Checksum, Observers...> observers = {};
+
+public:
+	ChecksumWithObservers() = default;
+	ChecksumWithObservers(uint32_t resumed) requires std::constructible_from<Checksum, uint32_t> : observers(Checksum(resumed), Observers()...) {}
+	auto operator() () { return std::get<0>(observers)(); }
+	auto operator() (std::span<const uint8_t> input) {
+		return std::apply([input] (Checksum& checksum, Observers&... others) {
+			(others(input), ...);
+			return checksum(input);
+		}, observers);
+	}
+
+	// Access by type or by index, the checksum is at index 0
+	template <typename Observer>
+	Observer& get() {
+		return std::get<Observer>(observers);
+	}
+	template <int Index>
+	auto& get() {
+		return std::get<Index>(observers);
+	}
+};
+
+// Sizes of buffers of settings that have runtimeBufferSizes set to true, chosen when creating a decompressor
+struct BufferSizes {
+	int maxOutputBufferSize = 0;
+	int minOutputBufferSize = 0;
+	int inputBufferSize = 0;
+
+	template <DecompressionSettings Settings>
+	constexpr static BufferSizes of() {
+		return {Settings::maxOutputBufferSize, Settings::minOutputBufferSize, Settings::inputBufferSize};
+	}
+
+	// Picks sizes for data of a known size, the uncompressed size is estimated if not known
+	// The uncompressed size is only a hint, larger data is decompressed correctly, only in more batches
+	static BufferSizes forInputSize(int64_t compressedSize, std::optional<int64_t> uncompressedSize = std::nullopt) {
+		constexpr int windowSize = 32768;
+		constexpr int64_t maxInputSize = 1 << 20;
+		constexpr int64_t maxBatchSize = 1 << 23;
+		int64_t expected = uncompressedSize.value_or(compressedSize * 4);
+		BufferSizes sizes;
+		sizes.minOutputBufferSize = windowSize;
+		sizes.maxOutputBufferSize = windowSize + std::clamp<int64_t>(expected + 1, 4096, maxBatchSize);
+		sizes.inputBufferSize = std::clamp<int64_t>(compressedSize + 16, 1024, maxInputSize);
+		return sizes;
+	}
+};
+
+template <typename Settings>
+constexpr bool hasRuntimeBufferSizes() {
+	if constexpr (requires { bool(Settings::runtimeBufferSizes); }) {
+		return Settings::runtimeBufferSizes;
+	} else {
+		return false;
+	}
+}
+
+template <typename Settings>
+constexpr bool hasCircularOutputBuffer() {
+	if constexpr (requires { bool(Settings::circularOutputBuffer); }) {
+		return Settings::circularOutputBuffer;
+	} else {
+		return false;
+	}
+}
+
+enum class DeflateBlockType {
+	STORED,
+	FIXED,
+	DYNAMIC
+};
+
+// Describes a deflate block when its decompression starts
+struct DeflateBlockInfo {
+	int64_t compressedBitOffset = 0; // From the start of the input, including any headers before the deflate stream
+	int64_t uncompressedOffset = 0;
+	DeflateBlockType type = DeflateBlockType::STORED;
+	bool last = false;
+	std::span<const char> window = {}; // Up to 32 kiB of data preceding the block, valid only until the observer returns
+	std::span<const uint8_t> literalCodeLengths = {}; // Huffman code lengths of literals and lengths (0 if unused), empty for stored blocks
+	std::span<const uint8_t> distanceCodeLengths = {}; // Valid only until the observer returns, like the window
+};
+
+// A literal byte if distance is zero, otherwise a repetition of length bytes from distance bytes back
+struct DeflateToken {
+	uint16_t lengthOrLiteral = 0;
+	uint16_t distance = 0;
+};
+
+// A block start where decompression can continue without decompressing the data before it
+struct DeflateCheckpoint {
+	int64_t compressedBitOffset = 0;
+	int64_t uncompressedOffset = 0;
+	std::vector<char> window = {};
+};
+
 namespace Detail {
 
 static constexpr std::array<uint8_t, 19> codeCodingReorder = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
 
+// Code lengths used by blocks with fixed codes
+static constexpr std::array<uint8_t, 288> fixedLiteralCodeLengths = [] {
+	std::array<uint8_t, 288> lengths = {};
+	for (int i = 0; i < std::ssize(lengths); i++) {
+		lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	return lengths;
+}();
+static constexpr std::array<uint8_t, 32> fixedDistanceCodeLengths = [] {
+	std::array<uint8_t, 32> lengths = {};
+	std::fill(lengths.begin(), lengths.end(), 5);
+	return lengths;
+}();
+
+// Reads a little endian number from a memory location, checking bounds
+template <typename IntType>
+IntType readLittleEndian(std::span<const uint8_t> data, size_t offset) {
+	if (offset > data.size() || data.size() - offset < sizeof(IntType)) [[unlikely]] {
+		throw std::runtime_error("Unexpected end of data");
+	}
+	IntType result = 0;
+	for (int i = sizeof(IntType) - 1; i >= 0; i--) {
+		result = (result << 8) | data[offset + i];
+	}
+	return result;
+}
+
+template <typename IntType>
+void appendLittleEndian(std::vector<uint8_t>& data, IntType number) {
+	for (int i = 0; i < int(sizeof(IntType)); i++) {
+		data.push_back(uint8_t(uint64_t(number) >> (i * 8)));
+	}
+}
+
+// Reads consecutive parts of a state saved by saveState() methods
+struct SavedStateReader {
+	std::span<const uint8_t> data;
+	size_t position = 0;
+
+	template <typename IntType>
+	IntType get() {
+		IntType result = readLittleEndian<IntType>(data, position);
+		position += sizeof(IntType);
+		return result;
+	}
+
+	std::span<const uint8_t> getBytes(size_t size) {
+		if (position + size > data.size()) [[unlikely]] {
+			throw std::runtime_error("Unexpected end of data");
+		}
+		position += size;
+		return data.subspan(position - size, size);
+	}
+};
+
+// A buffer that is either an array or allocated without initialisation if its size is known only at runtime
+template <typename T, int StaticSize, bool Runtime>
+class Buffer {
+	std::array<T, StaticSize> contents = {};
+
+public:
+	Buffer(int size) {
+		if (size != StaticSize) [[unlikely]] {
+			throw std::logic_error("Buffer sizes can be changed only if the settings have runtimeBufferSizes set");
+		}
+	}
+	T* data() { return contents.data(); }
+	const T* data() const { return contents.data(); }
+	T* begin() { return contents.data(); }
+	T* end() { return contents.data() + StaticSize; }
+	constexpr size_t size() const { return StaticSize; }
+	T& operator[](int index) { return contents[index]; }
+};
+
+template <typename T, int StaticSize>
+class Buffer<T, StaticSize, true> {
+	std::unique_ptr<T[]> contents;
+	int length = 0;
+
+public:
+	Buffer(int size) : contents(std::make_unique_for_overwrite<T[]>(size)), length(size) {}
+	T* data() { return contents.get(); }
+	const T* data() const { return contents.get(); }
+	T* begin() { return contents.get(); }
+	T* end() { return contents.get() + length; }
+	size_t size() const { return length; }
+	T& operator[](int index) { return contents[index]; }
+};
+
+// Makes a function for ByteInput that reads data from memory, the memory must stay valid while it's used
+inline std::function<int(std::span<uint8_t> batch)> readFromSpan(std::span<const uint8_t> data) {
+	return [data] (std::span<uint8_t> batch) mutable -> int {
+		int copying = std::min(batch.size(), data.size());
+		memcpy(batch.data(), data.data(), copying);
+		data = data.subspan(copying);
+		return copying;
+	};
+}
+
 // Provides access to input stream as chunks of contiguous data
 template <DecompressionSettings Settings>
 class ByteInput {
-	std::array<uint8_t, Settings::inputBufferSize + sizeof(uint32_t)> buffer = {};
+	Buffer<uint8_t, Settings::inputBufferSize + sizeof(uint32_t), hasRuntimeBufferSizes<Settings>()> buffer;
 	std::function<int(std::span<uint8_t> batch)> readMore;
+	std::function<bool()> waitForMore; // If set, readMore returning 0 means that more data may come later
+	std::function<void()> onStarving = {}; // If set, it's called instead of waiting if there is enough data for the current read
+	std::function<void(int64_t position)> seek = {}; // If set, makes readMore continue from the given position in the stream
 	int position = 0;
 	int filled = 0;
+	int64_t discarded = 0; // Bytes removed from the start of the buffer
 
-	int refillSome() {
+	int refillSome(int wanted) {
 		if (position > std::ssize(buffer) / 2) {
-			filled -= position;
-			memmove(buffer.data(), &buffer[position], filled);
-			position = 0;
+			// Bytes read by a BitReader before the refill may still be returned, unless the buffer is too small for it
+			int keptBytes = std::min<int>({position, sizeof(uint64_t), int(std::ssize(buffer) / 4)});
+			filled -= position - keptBytes;
+			memmove(buffer.data(), &buffer[position - keptBytes], filled);
+			discarded += position - keptBytes;
+			position = keptBytes;
 		}
 		int added = readMore(std::span<uint8_t>(buffer.begin() + filled, buffer.end()));
+		if (added == 0 && waitForMore && onStarving && filled - position >= wanted) {
+			onStarving();
+			return 0;
+		}
+		while (added == 0 && waitForMore && waitForMore()) {
+			added = readMore(std::span<uint8_t>(buffer.begin() + filled, buffer.end()));
+		}
 		filled += added;
 		return added;
 	}
 
 	void ensureSize(int bytes) {
 		while ((position) + bytes > filled) [[unlikely]] {
-			int added = refillSome();
+			int added = refillSome(bytes);
 			if (added == 0) {
 				throw std::runtime_error("Unexpected end of stream");
 			}
@@ -174,12 +518,14 @@ class ByteInput {
 	}
 
 public:
-	ByteInput(std::function<int(std::span<uint8_t> batch)> readMoreFunction) : readMore(readMoreFunction) {}
+	ByteInput(std::function<int(std::span<uint8_t> batch)> readMoreFunction, std::function<bool()> waitForMoreFunction = {},
+			int bufferSize = Settings::inputBufferSize)
+		: buffer(bufferSize + sizeof(uint32_t)), readMore(readMoreFunction), waitForMore(waitForMoreFunction) {}
 
 	// Note: May not get as many bytes as necessary, would need to be called multiple times
 	std::span<const uint8_t> getRange(int size) {
-		if (position + size >= filled) {
-			refillSome();
+		if (position + size > filled) {
+			refillSome(1);
 		}
 		ssize_t start = position;
 		int available = std::min<int>(size, filled - start);
@@ -187,6 +533,48 @@ public:
 		return {buffer.begin() + start, buffer.begin() + start + available};
 	}
 
+	void setSeeking(std::function<void(int64_t position)> seekFunction) {
+		seek = std::move(seekFunction);
+	}
+
+	// Moves forward to the position in the stream, by seeking if possible or by reading and dropping data
+	void skipTo(int64_t target) {
+		if (target < streamPosition()) [[unlikely]] {
+			throw std::logic_error("Can't move back in the input");
+		}
+		if (target <= discarded + filled) {
+			position = target - discarded;
+		} else if (seek) {
+			seek(target);
+			position = 0;
+			filled = 0;
+			discarded = target;
+		}
+		while (streamPosition() < target) {
+			if (position == filled && refillSome(1) == 0) {
+				throw std::runtime_error("Unexpected end of stream");
+			}
+			position += std::min<int64_t>(filled - position, target - streamPosition());
+		}
+	}
+
+	// Forgets the buffered data, for reading another stream with the same function
+	void reset() {
+		position = 0;
+		filled = 0;
+		discarded = 0;
+	}
+
+	// The function is called when reading more data would have to wait, but there is still some data to be processed
+	void setStarvingHandler(std::function<void()> handler) {
+		onStarving = std::move(handler);
+	}
+
+	// Number of bytes read since the start of the stream
+	int64_t streamPosition() const {
+		return discarded + position;
+	}
+
 	uint64_t getBytes(int amount) {
 		return getInteger<int64_t>(amount);
 	}
@@ -200,7 +588,7 @@ public:
 		return result;
 	}
 
-	// Can return only up to the size of the last read
+	// Can return only up to the size of the last reads
 	void returnBytes(int amount) {
 		position -= amount;
 	}
@@ -224,8 +612,15 @@ class BitReader {
 	static constexpr int minimumBits = 16; // The specification doesn't require any reading by bits that are longer than 16 bits
 
 	void refillIfNeeded() {
-		if (bitsLeft < minimumBits) {
+		// The input may provide fewer bytes than asked for, so it has to be repeated until it has enough or there is nothing more
+		while (bitsLeft < minimumBits) {
+			if (bitsLeft < 0) [[unlikely]] {
+				throw std::runtime_error("Unexpected end of stream"); // Some of the last bits read were beyond the end
+			}
 			std::span<const uint8_t> added = input->getRange(sizeof(data) - (minimumBits / 8));
+			if (added.empty()) {
+				break;
+			}
 			union {
 				std::array<uint8_t, sizeof(uint64_t)> bytes;
 				uint64_t number = 0;
@@ -284,6 +679,11 @@ public:
 			input->returnBytes(bitsLeft >> 3);
 	}
 
+	// Bits already taken from the input but not read yet
+	int bitsBuffered() const {
+		return bitsLeft;
+	}
+
 	class BitGroup {
 		BitReader* parent = nullptr;
 		uint64_t data = 0;
@@ -347,6 +747,8 @@ public:
 
 	// Uses the table in the specification to determine how many bytes are copied
 	int parseLongerSize(int partOfSize) {
+		if (partOfSize > 31) [[unlikely]]
+			throw std::runtime_error("Corrupted data, invalid length code");
 		if (partOfSize != 31) {
 			// Sizes in this range take several extra bits
 			int size = partOfSize;
@@ -362,6 +764,8 @@ public:
 
 	// Uses the table in the specification to determine distance from where bytes are copied
 	int parseLongerDistance(int partOfDistance) {
+		if (partOfDistance > 30) [[unlikely]]
+			throw std::runtime_error("Corrupted data, invalid distance code");
 		int readMore = (partOfDistance - 3) >> 1;
 		auto moreBits = getBitsForwardOrder(readMore);
 		constexpr static std::array<int, 30> distanceOffsets = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33,
@@ -371,13 +775,26 @@ public:
 	}
 };
 
+template <typename Checksum>
+Checksum resumedChecksum(uint32_t value) {
+	if constexpr (std::constructible_from<Checksum, uint32_t>) {
+		return Checksum(value);
+	} else {
+		throw std::logic_error("The checksum type can't continue from a saved value");
+	}
+}
+
 // Handles output of decompressed data, filling bytes from past bytes and chunking. Consume needs to be called to empty it
 template <DecompressionSettings Settings>
-class ByteOutput {
-	std::array<char, Settings::maxOutputBufferSize> buffer = {};
+class LinearByteOutput {
+	Buffer<char, Settings::maxOutputBufferSize, hasRuntimeBufferSizes<Settings>()> buffer;
+	int minimumKept = Settings::minOutputBufferSize;
 	int used = 0; // Number of bytes filled in the buffer (valid data must start at index 0)
 	int consumed = 0; // The last byte that was returned by consume()
+	int64_t discarded = 0; // Bytes removed from the start of the buffer
 	bool expectsMore = true; // If we expect more data to be present
+	int batchLimit = std::numeric_limits<int>::max(); // Maximum number of bytes produced between consume() calls
+	int limit = 0; // Position in the buffer where decompression stops until the next consume() call
 	typename Settings::Checksum checksum = {};
 
 	void checkSize(int added = 1) {
@@ -387,8 +804,35 @@ class ByteOutput {
 	}
 
 public:
+	LinearByteOutput(const BufferSizes& sizes = BufferSizes::of<Settings>())
+			: buffer(sizes.maxOutputBufferSize), minimumKept(sizes.minOutputBufferSize), limit(buffer.size()) {
+		if (minimumKept >= sizes.maxOutputBufferSize || minimumKept < 0) [[unlikely]] {
+			throw std::logic_error("Maximal output buffer size must be larger than the minimal size");
+		}
+	}
+
 	int available() {
-		return buffer.size() - used;
+		return limit - used;
+	}
+
+	void setBatchLimit(int bytes) {
+		batchLimit = std::max(bytes, 1);
+		limit = std::min<int64_t>(buffer.size(), int64_t(consumed) + batchLimit);
+	}
+
+	// Makes the decompression stop at the next opportunity, until consume() is called
+	void pause() {
+		limit = used;
+	}
+
+	// Longest part of the previous batch that can be kept by consume()
+	int maxKept() const {
+		return (std::ssize(buffer) - minimumKept) / 2;
+	}
+
+	// The last batch is always returned whole
+	bool hasUnconsumed() const {
+		return false;
 	}
 
 	std::span<const char> consume(const int bytesToKeep = 0) {
@@ -404,23 +848,40 @@ public:
 		// Clean the space from the previous consume() call
 		int bytesKept = std::min(bytesToKeep, consumed);
 		int removing = consumed - bytesKept;
-		int minimum = Settings::minOutputBufferSize - used + consumed; // Ensure we keep enough bytes that the operation will end with less valid data in the buffer than the mandatory minimum
+		int minimum = minimumKept - used + consumed; // Ensure we keep enough bytes that the operation will end with less valid data in the buffer than the mandatory minimum
 		if (bytesKept < minimum) {
 			bytesKept = minimum;
 			removing = consumed - bytesKept;
 		}
+		if (used <= std::ssize(buffer) / 2) {
+			bytesKept = consumed; // Small batches don't need to move the data every time
+			removing = 0;
+		}
 		if (removing < 0) [[unlikely]] {
 			throw std::logic_error("consume() cannot keep more bytes than it provided before");
 		}
 		memmove(buffer.begin(), buffer.begin() + removing, used - removing);
 		used -= removing;
+		discarded += removing;
 		consumed = used; // Make everything in the buffer available (except the data returned earlier)
+		limit = std::min<int64_t>(buffer.size(), int64_t(consumed) + batchLimit);
 
 		// Return a next batch
 		checksum(std::span<uint8_t>(reinterpret_cast<uint8_t*>(buffer.data() + bytesKept), consumed - bytesKept));
 		return std::span<const char>(buffer.data() + bytesKept, consumed - bytesKept);
 	}
 
+	// Number of bytes written since the start
+	int64_t producedBytes() const {
+		return discarded + used;
+	}
+
+	// Up to the deflate window size of the last written bytes
+	std::span<const char> window() const {
+		int size = std::min(used, 32768);
+		return std::span<const char>(buffer.data() + used - size, size);
+	}
+
 	void addByte(char byte) {
 		checkSize();
 		buffer[used] = byte;
@@ -454,152 +915,472 @@ public:
 	void done() { // Called when the whole buffer can be consumed because the data won't be needed anymore
 		expectsMore = false;
 	}
-};
 
-// Represents a table encoding Huffman codewords and can parse the stream by bits
-template <int MaxSize, typename ReaderType>
-class EncodedTable {
-	ReaderType& reader;
-	struct CodeEntry {
-		uint16_t code = 0;
-		uint8_t length = 0; // 0 if unused
-	};
-	std::array<CodeEntry, MaxSize> codes = {};
-	struct CodeRemainder {
-		uint8_t remainder = 0;
-		uint8_t bitsLeft = 0;
-		uint16_t index = 0; // bit or with 0x8000 if it's the last one in sequence
-	};
-	std::array<CodeRemainder, MaxSize> remainders = {};
-	std::array<int, 256> codesIndex = {}; // If value is greater than MaxSize, it's a remainder at index value minus MaxSize
+	// Prepares for another stream without releasing the buffer
+	void reset() {
+		used = 0;
+		consumed = 0;
+		discarded = 0;
+		expectsMore = true;
+		limit = std::min<int64_t>(buffer.size(), batchLimit);
+		checksum = {};
+	}
 
-	static constexpr int UNINDEXED = -1;
-	static constexpr int UNUSED = -2;
+	// Makes the end of the dictionary available for repetitions as if it was decompressed before, it's not returned or checksummed
+	void prime(std::span<const char> dictionary) {
+		if (dictionary.empty()) {
+			return;
+		}
+		dictionary = dictionary.last(std::min<size_t>(dictionary.size(), 32768));
+		addBytes(dictionary);
+		consumed = used;
+		discarded -= dictionary.size();
+		limit = std::min<int64_t>(buffer.size(), int64_t(consumed) + batchLimit);
+	}
 
-public:
-	EncodedTable(ReaderType& reader, int realSize, std::array<uint8_t, 256> codeCodingLookup, std::array<uint8_t, codeCodingReorder.size()> codeCodingLengths)
-	: reader(reader) {
-		std::array<int, 17> quantities = {};
+	// Adds what's needed to continue with restoreState() later, the last 32 kiB of data, their total size and the checksum
+	void saveState(std::vector<uint8_t>& saved) {
+		std::span<const char> history = window();
+		appendLittleEndian<int64_t>(saved, producedBytes());
+		appendLittleEndian<uint32_t>(saved, checksum());
+		appendLittleEndian<uint16_t>(saved, 0); // All data are always consumed
+		appendLittleEndian<uint16_t>(saved, history.size());
+		saved.insert(saved.end(), history.begin(), history.end());
+	}
 
-		// Read the Huffman-encoded Huffman codes
-		for (int i = 0; i < realSize; ) {
-			int length = 0;
-			reader.peekAByteAndConsumeSome([&] (uint8_t peeked) {
-				length = codeCodingLookup[peeked];
-				return codeCodingLengths[length];
-			});
-			if (length < 16) {
-				codes[i].length = length;
-				i++;
-				quantities[length]++;
-			} else if (length == 16) {
-				if (i == 0) [[unlikely]]
-					throw std::runtime_error("Invalid lookback position");
-				int copy = reader.getBitsForwardOrder(2) + 3;
-				for (int j = i; j < i + copy; j++) {
-					codes[j].length = codes[i - 1].length;
-				}
-				quantities[codes[i - 1].length] += copy;
-				i += copy;
-			} else if (length > 16) {
-				int zeroCount = 0;
-				if (length == 17) {
-					zeroCount = reader.getBitsForwardOrder(3) + 3;
-				} else {
-					int sevenBitsValue = reader.getBitsForwardOrder(7);
-					zeroCount = sevenBitsValue + 11;
-				};
-				for (int j = i; j < i + zeroCount; j++) {
-					codes[j].length = 0;
-				}
-				i += zeroCount;
-			}
+	void restoreState(SavedStateReader& saved) {
+		int64_t produced = saved.get<int64_t>();
+		uint32_t savedChecksum = saved.get<uint32_t>();
+		if (saved.get<uint16_t>() != 0) [[unlikely]] {
+			throw std::runtime_error("Saved state has data that weren't returned, it was saved with a different output buffer type");
 		}
+		std::span<const uint8_t> history = saved.getBytes(saved.get<uint16_t>());
+		restoreWindow(produced, std::span<const char>(reinterpret_cast<const char*>(history.data()), history.size()));
+		checksum = resumedChecksum<typename Settings::Checksum>(savedChecksum);
+	}
 
-		for (int& it : codesIndex) it = UNUSED;
+	// Continues as if the given number of bytes ending with the window was produced, the checksum starts anew
+	void restoreWindow(int64_t produced, std::span<const char> history) {
+		reset();
+		prime(history);
+		discarded = produced - used;
+	}
+};
 
-		struct UnindexedEntry {
-			int quantity = 0;
-			int startIndex = 0;
-			int filled = 0;
-		};
-		std::array<UnindexedEntry, 256> unindexedEntries = {};
+// Keeps only the last 32 kiB in a ring buffer, so the memory used is independent of the batch size and the data is never moved
+// The rest of the buffer precedes the ring and holds the bytes kept from the previous batch when a batch starts at the ring's beginning
+template <DecompressionSettings Settings>
+class CircularByteOutput {
+	constexpr static int ringSize = 32768;
+	Buffer<char, Settings::maxOutputBufferSize, hasRuntimeBufferSizes<Settings>()> buffer;
+	int keptSize = 0; // Size of the part before the ring
+	int64_t used = 0; // Number of bytes written since the start
+	int64_t consumed = 0; // Number of bytes returned by consume()
+	int64_t primed = 0; // Bytes of a dictionary written before the start, negative after restoring a state
+	int batchLimit = std::numeric_limits<int>::max();
+	int64_t limit = 0;
+	typename Settings::Checksum checksum = {};
 
-		// Generate the codes
-		int nextCode = 0;
-		for (int size = 1; size <= 16; size++) {
-			if (quantities[size] > 0) {
-				for (int i = 0; i <= realSize; i++) {
-					if (codes[i].length == size) {
-						if (nextCode >= (1 << size)) [[unlikely]]
-								throw std::runtime_error("Bad Huffman encoding, run out of Huffman codes");
-						codes[i].code = nextCode;
-						if (size <= 8) [[likely]] {
-							for (int code = codes[i].code << (8 - size); code < (codes[i].code + 1) << (8 - size); code++) {
-								codesIndex[code] = i;
-							}
-						} else {
-							int startPart = nextCode >> (size - 8);
-							codesIndex[startPart] = UNINDEXED;
-							unindexedEntries[startPart].quantity++;
-						}
-						nextCode++;
-					}
-				}
-			}
-			nextCode <<= 1;
-		}
+	char* ring() {
+		return buffer.data() + keptSize;
+	}
 
-		// Calculate ranges of the longer parts
-		int currentStartIndex = 0;
-		for (auto& entry : unindexedEntries) {
-			entry.startIndex = currentStartIndex;
-			currentStartIndex += entry.quantity;
+	static int ringPosition(int64_t position) {
+		return position & (ringSize - 1);
+	}
+
+	// Nothing returned since the last consume() or kept before it may be overwritten
+	int64_t writableEnd() const {
+		return consumed + ringSize - keptSize;
+	}
+
+	void checkSize(int added = 1) {
+		if (used + added > writableEnd()) [[unlikely]] {
+			throw std::logic_error("Writing more bytes than available, probably an internal bug");
 		}
+	}
 
-		// Index the longer parts
-		for (int i = 0; i < std::ssize(codes); i++) {
-			CodeEntry& code = codes[i];
-			if (code.length > 8) {
-				int index = code.code >> (code.length - 8);
-				UnindexedEntry& unindexedEntry = unindexedEntries[index];
-				CodeRemainder& remainder = remainders[unindexedEntry.startIndex + unindexedEntry.filled];
-				codesIndex[index] = MaxSize + unindexedEntry.startIndex;
-				unindexedEntry.filled++;
-				remainder.remainder = (code.code << (16 - code.length)); // The upper bits are cut
-				remainder.bitsLeft = code.length - 8;
-				remainder.index = i;
-				if (unindexedEntry.filled == unindexedEntry.quantity)
-					remainder.index |= 0x8000;
-			}
+public:
+	CircularByteOutput(const BufferSizes& sizes = BufferSizes::of<Settings>())
+			: buffer(sizes.maxOutputBufferSize), keptSize(sizes.maxOutputBufferSize - ringSize), limit(writableEnd()) {
+		if (keptSize <= 0 || keptSize >= ringSize) [[unlikely]] {
+			throw std::logic_error("Circular output buffer must be larger than 32 kiB and smaller than 64 kiB");
 		}
 	}
 
-	int readWord() {
-		int word = 0;
-		uint8_t firstByte = 0;
-		reader.peekAByteAndConsumeSome([&] (uint8_t peeked) {
-			firstByte = peeked;
-			word = codesIndex[peeked];
-			if (word >= MaxSize) {
-				return 8;
-			} else if (word == UNUSED) {
-				throw std::runtime_error("Unknown Huffman code (not even first 8 bits)");
-			}
-			return int(codes[word].length);
-		});
+	int available() {
+		return limit - used;
+	}
 
-		// Longer codes than a byte are indexed specially
-		static constexpr std::array<uint8_t, 9> startMasks = { 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff };
-		if (word >= MaxSize) {
-			reader.peekAByteAndConsumeSome([&] (uint8_t peeked) {
-				for (int i = word - MaxSize; i < MaxSize * 2; i++) {
-					if ((peeked & startMasks[remainders[i].bitsLeft]) == remainders[i].remainder) {
-						word = remainders[i].index & 0x7fff;
-						return remainders[i].bitsLeft;
-					}
+	void setBatchLimit(int bytes) {
+		batchLimit = std::max(bytes, 1);
+		limit = std::min(writableEnd(), consumed + batchLimit);
+	}
 
-					if (remainders[i].index & 0x8000) {
+	void pause() {
+		limit = used;
+	}
+
+	int maxKept() const {
+		return keptSize;
+	}
+
+	// Data that wrap around the end of the ring are returned in two batches
+	bool hasUnconsumed() const {
+		return used > consumed;
+	}
+
+	std::span<const char> consume(const int bytesToKeep = 0) {
+		if (bytesToKeep > keptSize) [[unlikely]] {
+			throw std::logic_error("consume() cannot keep more bytes than the space before the ring buffer");
+		}
+		int start = ringPosition(consumed);
+		if (start == 0 && consumed > 0) {
+			memcpy(ring() - keptSize, ring() + ringSize - keptSize, keptSize); // The previous bytes must precede the batch
+		}
+		int size = std::min<int64_t>(used - consumed, ringSize - start);
+		consumed += size;
+		limit = std::min(writableEnd(), consumed + batchLimit);
+		checksum(std::span<uint8_t>(reinterpret_cast<uint8_t*>(ring() + start), size));
+		return std::span<const char>(ring() + start, size);
+	}
+
+	int64_t producedBytes() const {
+		return used - primed;
+	}
+
+	// Up to the deflate window size of the last written bytes, shorter if they wrap around the end of the ring
+	std::span<const char> window() const {
+		int end = ringPosition(used);
+		if (end == 0 && used > 0) {
+			end = ringSize;
+		}
+		int size = std::min<int64_t>(used, end);
+		return std::span<const char>(buffer.data() + keptSize + end - size, size);
+	}
+
+	void addByte(char byte) {
+		checkSize();
+		ring()[ringPosition(used)] = byte;
+		used++;
+	}
+
+	void addBytes(std::span<const char> bytes) {
+		checkSize(bytes.size());
+		while (!bytes.empty()) {
+			int position = ringPosition(used);
+			int copying = std::min<int>(bytes.size(), ringSize - position);
+			memcpy(ring() + position, bytes.data(), copying);
+			used += copying;
+			bytes = bytes.subspan(copying);
+		}
+	}
+
+	void repeatSequence(int length, int distance) {
+		checkSize(length);
+		if (distance > used) {
+			throw std::runtime_error("Looking back too many bytes, corrupted archive or insufficient buffer size");
+		}
+		while (length > 0) {
+			int from = ringPosition(used - distance);
+			int to = ringPosition(used);
+			int toWrite = std::min({length, distance, ringSize - from, ringSize - to});
+			memmove(ring() + to, ring() + from, toWrite);
+			used += toWrite;
+			length -= toWrite;
+		}
+	}
+
+	auto& getChecksum() {
+		return checksum;
+	}
+
+	void done() {} // All data are returned the same way
+
+	void reset() {
+		used = 0;
+		consumed = 0;
+		primed = 0;
+		limit = std::min(writableEnd(), consumed + batchLimit);
+		checksum = {};
+	}
+
+	void prime(std::span<const char> dictionary) {
+		dictionary = dictionary.last(std::min<size_t>(dictionary.size(), ringSize));
+		consumed = used + dictionary.size(); // It's never returned, so all of the ring can be filled
+		addBytes(dictionary);
+		primed = used;
+		limit = std::min(writableEnd(), consumed + batchLimit);
+	}
+
+	// The last 32 kiB may wrap around the end of the ring, bytes that weren't returned yet are saved too
+	void saveState(std::vector<uint8_t>& saved) {
+		int size = std::min<int64_t>(used, ringSize);
+		appendLittleEndian<int64_t>(saved, producedBytes());
+		appendLittleEndian<uint32_t>(saved, checksum());
+		appendLittleEndian<uint16_t>(saved, used - consumed);
+		appendLittleEndian<uint16_t>(saved, size);
+		for (int64_t position = used - size; position < used; ) {
+			int copying = std::min<int64_t>(used - position, ringSize - ringPosition(position));
+			saved.insert(saved.end(), ring() + ringPosition(position), ring() + ringPosition(position) + copying);
+			position += copying;
+		}
+	}
+
+	void restoreState(SavedStateReader& saved) {
+		int64_t produced = saved.get<int64_t>();
+		uint32_t savedChecksum = saved.get<uint32_t>();
+		int unconsumed = saved.get<uint16_t>();
+		std::span<const uint8_t> history = saved.getBytes(saved.get<uint16_t>());
+		if (unconsumed > std::ssize(history)) [[unlikely]] {
+			throw std::runtime_error("Corrupted saved state");
+		}
+		restoreWindow(produced, std::span<const char>(reinterpret_cast<const char*>(history.data()), history.size()));
+		consumed = used - unconsumed;
+		limit = std::min(writableEnd(), consumed + batchLimit);
+		checksum = resumedChecksum<typename Settings::Checksum>(savedChecksum);
+	}
+
+	void restoreWindow(int64_t produced, std::span<const char> history) {
+		reset();
+		prime(history);
+		primed = used - produced;
+	}
+};
+
+template <DecompressionSettings Settings>
+using ByteOutput = std::conditional_t<hasCircularOutputBuffer<Settings>(), CircularByteOutput<Settings>, LinearByteOutput<Settings>>;
+
+// Collects the tokens of the decompressed data instead of the data, repetitions are never split because the space is counted in tokens
+class TokenOutput {
+	std::vector<DeflateToken> tokens = {};
+	std::vector<DeflateToken> returned = {};
+	int64_t produced = 0; // Number of bytes the tokens represent
+	bool paused = false;
+	constexpr static int batchSize = 16384;
+
+public:
+	int available() {
+		return (paused || std::ssize(tokens) >= batchSize) ? 0 : std::numeric_limits<int>::max();
+	}
+
+	void pause() {
+		paused = true;
+	}
+
+	std::span<const DeflateToken> consume() {
+		std::swap(tokens, returned);
+		tokens.clear();
+		paused = false;
+		return returned;
+	}
+
+	bool hasTokens() const {
+		return !tokens.empty();
+	}
+
+	int64_t producedBytes() const {
+		return produced;
+	}
+
+	// There are no bytes to refer to
+	std::span<const char> window() const {
+		return {};
+	}
+
+	void addByte(char byte) {
+		tokens.push_back({uint8_t(byte), 0});
+		produced++;
+	}
+
+	void addBytes(std::span<const char> bytes) {
+		for (char byte : bytes) {
+			tokens.push_back({uint8_t(byte), 0});
+		}
+		produced += bytes.size();
+	}
+
+	void repeatSequence(int length, int distance) {
+		if (distance > produced) {
+			throw std::runtime_error("Looking back too many bytes, corrupted archive");
+		}
+		tokens.push_back({uint16_t(length), uint16_t(distance)});
+		produced += length;
+	}
+
+	void done() {}
+};
+
+// Reads Huffman-encoded code lengths, the lengths of both tables of a dynamic block are read at once,
+// because a run of repeated lengths may continue from the literal table into the distance table
+template <int MaxSize, typename ReaderType>
+std::array<uint8_t, MaxSize> readCodeLengths(ReaderType& reader, int count, const std::array<uint8_t, 256>& codeCodingLookup,
+		const std::array<uint8_t, codeCodingReorder.size()>& codeCodingLengths) {
+	std::array<uint8_t, MaxSize> lengths = {};
+	for (int i = 0; i < count; ) {
+		int length = 0;
+		reader.peekAByteAndConsumeSome([&] (uint8_t peeked) {
+			length = codeCodingLookup[peeked];
+			return codeCodingLengths[length];
+		});
+		if (length < 16) {
+			lengths[i] = length;
+			i++;
+		} else if (length == 16) {
+			if (i == 0) [[unlikely]]
+				throw std::runtime_error("Invalid lookback position");
+			int copy = reader.getBitsForwardOrder(2) + 3;
+			if (i + copy > count) [[unlikely]]
+				throw std::runtime_error("Corrupted data, Huffman code lengths repeated beyond the table");
+			std::fill_n(lengths.begin() + i, copy, lengths[i - 1]);
+			i += copy;
+		} else {
+			int zeroCount = (length == 17) ? reader.getBitsForwardOrder(3) + 3 : reader.getBitsForwardOrder(7) + 11;
+			if (i + zeroCount > count) [[unlikely]]
+				throw std::runtime_error("Corrupted data, Huffman code lengths repeated beyond the table");
+			i += zeroCount; // Already zeroed
+		}
+	}
+	return lengths;
+}
+
+// Represents a table encoding Huffman codewords and can parse the stream by bits
+template <int MaxSize, typename ReaderType>
+class EncodedTable {
+	ReaderType& reader;
+	struct CodeEntry {
+		uint16_t code = 0;
+		uint8_t length = 0; // 0 if unused
+	};
+	std::array<CodeEntry, MaxSize> codes = {};
+	struct CodeRemainder {
+		uint8_t remainder = 0;
+		uint8_t bitsLeft = 0;
+		uint16_t index = 0; // bit or with 0x8000 if it's the last one in sequence
+	};
+	std::array<CodeRemainder, MaxSize> remainders = {};
+	std::array<int16_t, 256> codesIndex = {}; // If value is greater than MaxSize, it's a remainder at index value minus MaxSize
+
+	static constexpr int UNINDEXED = -1;
+	static constexpr int UNUSED = -2;
+
+public:
+	EncodedTable(ReaderType& reader, int realSize, const std::array<uint8_t, 256>& codeCodingLookup,
+			const std::array<uint8_t, codeCodingReorder.size()>& codeCodingLengths)
+	: EncodedTable(reader, std::span<const uint8_t>(readCodeLengths<MaxSize>(reader, realSize, codeCodingLookup, codeCodingLengths)).first(realSize)) {}
+
+	// Creates the table from saved code lengths
+	EncodedTable(ReaderType& reader, std::span<const uint8_t> lengths) : reader(reader) {
+		std::array<int, 17> quantities = {};
+		for (int i = 0; i < std::ssize(lengths); i++) {
+			if (lengths[i] > 15) [[unlikely]] {
+				throw std::runtime_error("Corrupted data, Huffman code too long");
+			}
+			codes[i].length = lengths[i];
+			quantities[lengths[i]]++;
+		}
+		generateCodes(lengths.size(), quantities);
+	}
+
+	constexpr static int size() {
+		return MaxSize;
+	}
+
+	std::array<uint8_t, MaxSize> codeLengths() const {
+		std::array<uint8_t, MaxSize> lengths = {};
+		for (int i = 0; i < MaxSize; i++) {
+			lengths[i] = codes[i].length;
+		}
+		return lengths;
+	}
+
+private:
+	void generateCodes(int realSize, const std::array<int, 17>& quantities) {
+		codesIndex.fill(UNUSED);
+
+		struct UnindexedEntry {
+			int quantity = 0;
+			int startIndex = 0;
+			int filled = 0;
+		};
+		std::array<UnindexedEntry, 256> unindexedEntries = {};
+
+		// Generate the codes
+		int nextCode = 0;
+		for (int size = 1; size <= 16; size++) {
+			if (quantities[size] > 0) {
+				for (int i = 0; i < realSize; i++) {
+					if (codes[i].length == size) {
+						if (nextCode >= (1 << size)) [[unlikely]]
+								throw std::runtime_error("Bad Huffman encoding, run out of Huffman codes");
+						codes[i].code = nextCode;
+						if (size <= 8) [[likely]] {
+							for (int code = codes[i].code << (8 - size); code < (codes[i].code + 1) << (8 - size); code++) {
+								codesIndex[code] = i;
+							}
+						} else {
+							int startPart = nextCode >> (size - 8);
+							codesIndex[startPart] = UNINDEXED;
+							unindexedEntries[startPart].quantity++;
+						}
+						nextCode++;
+					}
+				}
+			}
+			nextCode <<= 1;
+		}
+
+		// Calculate ranges of the longer parts
+		int currentStartIndex = 0;
+		for (auto& entry : unindexedEntries) {
+			entry.startIndex = currentStartIndex;
+			currentStartIndex += entry.quantity;
+		}
+
+		// Index the longer parts
+		for (int i = 0; i < std::ssize(codes); i++) {
+			CodeEntry& code = codes[i];
+			if (code.length > 8) {
+				int index = code.code >> (code.length - 8);
+				UnindexedEntry& unindexedEntry = unindexedEntries[index];
+				CodeRemainder& remainder = remainders[unindexedEntry.startIndex + unindexedEntry.filled];
+				codesIndex[index] = MaxSize + unindexedEntry.startIndex;
+				unindexedEntry.filled++;
+				remainder.remainder = (code.code << (16 - code.length)); // The upper bits are cut
+				remainder.bitsLeft = code.length - 8;
+				remainder.index = i;
+				if (unindexedEntry.filled == unindexedEntry.quantity)
+					remainder.index |= 0x8000;
+			}
+		}
+	}
+
+public:
+	int readWord() {
+		int word = 0;
+		uint8_t firstByte = 0;
+		reader.peekAByteAndConsumeSome([&] (uint8_t peeked) {
+			firstByte = peeked;
+			word = codesIndex[peeked];
+			if (word >= MaxSize) {
+				return 8;
+			} else if (word == UNUSED) {
+				throw std::runtime_error("Unknown Huffman code (not even first 8 bits)");
+			}
+			return int(codes[word].length);
+		});
+
+		// Longer codes than a byte are indexed specially
+		static constexpr std::array<uint8_t, 9> startMasks = { 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff };
+		if (word >= MaxSize) {
+			reader.peekAByteAndConsumeSome([&] (uint8_t peeked) {
+				for (int i = word - MaxSize; i < MaxSize; i++) {
+					if ((peeked & startMasks[remainders[i].bitsLeft]) == remainders[i].remainder) {
+						word = remainders[i].index & 0x7fff;
+						return remainders[i].bitsLeft;
+					}
+
+					if (remainders[i].index & 0x8000) {
 						throw std::runtime_error("Unknown Huffman code (ending bits don't fit)");
 					}
 				}
@@ -617,22 +1398,22 @@ auto ByteInput<Settings>::encodedTable(int realSize, const std::array<uint8_t, 2
 }
 
 // Higher level class handling the overall state of parsing. Implemented as a state machine to allow pausing when output is full.
-template <DecompressionSettings Settings>
+template <DecompressionSettings Settings, typename Output = ByteOutput<Settings>>
 class DeflateReader {
 	ByteInput<Settings>& input;
-	ByteOutput<Settings>& output;
+	Output& output;
 
 	struct CopyState {
 		int copyDistance = 0;
 		int copyLength = 0;
 
-		bool restart(ByteOutput<Settings>& output) {
+		bool restart(Output& output) {
 			int copying = std::min(output.available(), copyLength);
 			output.repeatSequence(copying, copyDistance);
 			copyLength -= copying;
 			return (copyLength == 0);
 		}
-		bool copy(ByteOutput<Settings>& output, int length, int distance) {
+		bool copy(Output& output, int length, int distance) {
 			copyLength = length;
 			copyDistance = distance;
 			return restart(output);
@@ -641,6 +1422,7 @@ class DeflateReader {
 
 	struct LiteralState {
 		int bytesLeft = 0;
+		LiteralState(int bytesLeft) : bytesLeft(bytesLeft) {}
 		LiteralState(DeflateReader* parent) {
 			int length = parent->input.getBytes(2);
 			int antiLength = parent->input.getBytes(2);
@@ -650,14 +1432,23 @@ class DeflateReader {
 			bytesLeft = length;
 		}
 
+		// Sources that can wait for more data do it inside getRange(), so getting nothing means the stream ended
+		static std::span<const uint8_t> getRange(DeflateReader* parent, int size) {
+			std::span<const uint8_t> chunk = parent->input.getRange(size);
+			if (chunk.empty() && size > 0) [[unlikely]] {
+				throw std::runtime_error("Unexpected end of stream");
+			}
+			return chunk;
+		}
+
 		bool parseSome(DeflateReader* parent) {
 			if (parent->output.available() > bytesLeft) {
-				std::span<const uint8_t> chunk = parent->input.getRange(bytesLeft);
+				std::span<const uint8_t> chunk = getRange(parent, bytesLeft);
 				parent->output.addBytes(std::span<const char>(reinterpret_cast<const char*>(chunk.data()), (chunk.size())));
 				bytesLeft -= chunk.size();
 				return (bytesLeft > 0);
 			} else {
-				std::span<const uint8_t> chunk = parent->input.getRange(parent->output.available());
+				std::span<const uint8_t> chunk = getRange(parent, parent->output.available());
 				bytesLeft -= chunk.size();
 				parent->output.addBytes(std::span<const char>(reinterpret_cast<const char*>(chunk.data()), (chunk.size())));
 				return true;
@@ -689,13 +1480,13 @@ class DeflateReader {
 					parent->output.addByte(uint8_t(part.value() - (0b110010000 - 144))); // Bits 144-255
 				} else {
 					int size = 0;
-					if (part <= 0010111) {
+					if (part <= 0b0010111) {
 						// 7 bit lookback
 						size = part.value() + 2; // First value means size 3
 					} else {
 						// 8 bit lookback, would be range 1100000 - 1100011
 						part.getMore(1);
-						size = part.value() + (25 - 0b11000000); // Placed after the 21 possible values of the 7 bit versions (+3)
+						size = part.value() + (26 - 0b11000000); // Placed after the 24 possible values of the 7 bit versions (+2)
 					}
 					if (size > 10) {
 						size = input.parseLongerSize(size);
@@ -718,12 +1509,19 @@ class DeflateReader {
 		EncodedTable<288, BitReader<ByteInput<Settings>>> codes;
 		EncodedTable<31, BitReader<ByteInput<Settings>>> distanceCode;
 
+		static constexpr int maxCodeLengths = decltype(codes)::size() + decltype(distanceCode)::size();
+
+		// The lengths are read from the input before it's moved into the state
 		DynamicCodeState(decltype(input)&& inputMoved, int codeCount, int distanceCodeCount, const std::array<uint8_t, 256>& codeCodingLookup,
 						const std::array<uint8_t, codeCodingReorder.size()>& codeCodingLengths)
-			: input(std::move(inputMoved))
-			, codes(input, codeCount, codeCodingLookup, codeCodingLengths)
-			, distanceCode(input, distanceCodeCount, codeCodingLookup, codeCodingLengths)
-		{ }
+			: DynamicCodeState(std::move(inputMoved), readCodeLengths<maxCodeLengths>(inputMoved, codeCount + distanceCodeCount, codeCodingLookup, codeCodingLengths),
+					codeCount, distanceCodeCount) {}
+
+		DynamicCodeState(decltype(input)&& inputMoved, const std::array<uint8_t, maxCodeLengths>& lengths, int codeCount, int distanceCodeCount)
+			: DynamicCodeState(std::move(inputMoved), std::span(lengths).first(codeCount), std::span(lengths).subspan(codeCount, distanceCodeCount)) {}
+
+		DynamicCodeState(decltype(input)&& inputMoved, std::span<const uint8_t> codeLengths, std::span<const uint8_t> distanceCodeLengths)
+			: input(std::move(inputMoved)), codes(input, codeLengths), distanceCode(input, distanceCodeLengths) {}
 
 		bool parseSome(DeflateReader* parent) {
 			if (CopyState::copyLength > 0) { // Resume copying if necessary
@@ -737,7 +1535,7 @@ class DeflateReader {
 				if (word < 256) {
 					parent->output.addByte(word);
 				} else if (word == 256) [[unlikely]] {
-					break;
+					return false; // The block may end when the output is full, that must not be mistaken for running out of space
 				} else {
 					int length = word - 254;
 					if (length > 10) {
@@ -756,9 +1554,111 @@ class DeflateReader {
 
 	std::variant<std::monostate, LiteralState, FixedCodeState, DynamicCodeState> decodingState = {};
 	bool wasLast = false;
+	int skippedBits = 0; // Bits of the first byte before the next block starts, when continuing from a block start
+	int64_t endBitPosition = -1; // Where the last block ended, once it did
 
 public:
-	DeflateReader(ByteInput<Settings>& input, ByteOutput<Settings>& output) : input(input), output(output) {}
+	std::function<void(const DeflateBlockInfo&)> blockObserver = {}; // Called at the start of every block if set
+
+	DeflateReader(ByteInput<Settings>& input, Output& output) : input(input), output(output) {}
+
+	// Adds the position in the compressed data and the state of the current block (the output has to be saved separately)
+	void saveState(std::vector<uint8_t>& saved) const {
+		int64_t bitPosition = input.streamPosition() * 8 + skippedBits;
+		const CopyState* copying = nullptr;
+		uint8_t type = 0; // Between blocks
+		if (const LiteralState* state = std::get_if<LiteralState>(&decodingState)) {
+			type = 1;
+		} else if (const FixedCodeState* state = std::get_if<FixedCodeState>(&decodingState)) {
+			type = 2;
+			bitPosition -= state->input.bitsBuffered();
+			copying = state;
+		} else if (const DynamicCodeState* state = std::get_if<DynamicCodeState>(&decodingState)) {
+			type = 3;
+			bitPosition -= state->input.bitsBuffered();
+			copying = state;
+		}
+		appendLittleEndian<int64_t>(saved, bitPosition);
+		appendLittleEndian<uint8_t>(saved, wasLast);
+		appendLittleEndian<uint8_t>(saved, type);
+		if (const LiteralState* state = std::get_if<LiteralState>(&decodingState)) {
+			appendLittleEndian<uint16_t>(saved, state->bytesLeft);
+		}
+		if (copying) {
+			appendLittleEndian<uint16_t>(saved, copying->copyLength);
+			appendLittleEndian<uint16_t>(saved, copying->copyDistance);
+		}
+		if (const DynamicCodeState* state = std::get_if<DynamicCodeState>(&decodingState)) {
+			// Code lengths are at most 15, so they are saved by 4 bits
+			auto literalLengths = state->codes.codeLengths();
+			auto distanceLengths = state->distanceCode.codeLengths();
+			std::vector<uint8_t> lengths(literalLengths.begin(), literalLengths.end());
+			lengths.insert(lengths.end(), distanceLengths.begin(), distanceLengths.end());
+			for (int i = 0; i < std::ssize(lengths); i += 2) {
+				saved.push_back(lengths[i] | ((i + 1 < std::ssize(lengths) ? lengths[i + 1] : 0) << 4));
+			}
+		}
+	}
+
+	// The bit after the end of the stream, known only after decompressing all of it
+	std::optional<int64_t> endPosition() const {
+		if (endBitPosition < 0) {
+			return std::nullopt;
+		}
+		return endBitPosition;
+	}
+
+	// Continues from the start of a block that isn't the first one, the input must not have been read beyond it
+	void startBlockAt(int64_t bitPosition) {
+		input.skipTo(bitPosition / 8);
+		decodingState = std::monostate();
+		wasLast = false;
+		skippedBits = bitPosition % 8;
+	}
+
+	// The input must not have been read beyond the saved position
+	void restoreState(SavedStateReader& saved) {
+		int64_t bitPosition = saved.get<int64_t>();
+		wasLast = saved.get<uint8_t>();
+		uint8_t type = saved.get<uint8_t>();
+		if (type == 0) {
+			startBlockAt(bitPosition);
+			return;
+		}
+		input.skipTo(bitPosition / 8);
+		if (type == 1) {
+			decodingState.template emplace<LiteralState>(saved.get<uint16_t>());
+		} else if (type == 2 || type == 3) {
+			int copyLength = saved.get<uint16_t>();
+			int copyDistance = saved.get<uint16_t>();
+			BitReader<ByteInput<Settings>> bitInput(&input);
+			if (bitPosition % 8 > 0) {
+				bitInput.getBits(bitPosition % 8);
+			}
+			CopyState* copying = nullptr;
+			if (type == 2) {
+				copying = &decodingState.template emplace<FixedCodeState>(std::move(bitInput));
+			} else {
+				constexpr int literalTableSize = decltype(DynamicCodeState::codes)::size();
+				constexpr int distanceTableSize = decltype(DynamicCodeState::distanceCode)::size();
+				std::span<const uint8_t> packed = saved.getBytes((literalTableSize + distanceTableSize + 1) / 2);
+				std::vector<uint8_t> lengths;
+				for (uint8_t pair : packed) {
+					lengths.push_back(pair & 0x0f);
+					lengths.push_back(pair >> 4);
+				}
+				copying = &decodingState.template emplace<DynamicCodeState>(std::move(bitInput), std::span(lengths).first(literalTableSize),
+						std::span(lengths).subspan(literalTableSize, distanceTableSize));
+			}
+			if (copyLength > 258 || copyDistance > 32768) [[unlikely]] {
+				throw std::runtime_error("Corrupted saved state");
+			}
+			copying->copyLength = copyLength;
+			copying->copyDistance = copyDistance;
+		} else {
+			throw std::runtime_error("Corrupted saved state");
+		}
+	}
 
 	// Returns whether there is more work to do
 	bool parseSome() {
@@ -781,14 +1681,22 @@ public:
 				bitInput = std::move(state->input);
 			} else {
 				bitInput = BitReader<ByteInput<Settings>>(&input);
+				if (skippedBits > 0) {
+					bitInput.getBits(skippedBits);
+					skippedBits = 0;
+				}
 			}
 			decodingState = std::monostate();
 
 			// No decoding state
 			if (wasLast) {
+				if (endBitPosition < 0) {
+					endBitPosition = input.streamPosition() * 8 - bitInput.bitsBuffered();
+				}
 				output.done();
 				return false;
 			}
+			int64_t blockStart = input.streamPosition() * 8 - bitInput.bitsBuffered();
 			wasLast = bitInput.getBits(1).value();
 			auto compressionType = bitInput.getBits(2);
 			if (compressionType == 0b00) {
@@ -825,6 +1733,9 @@ public:
 					for (int i = 0; i < std::ssize(codeCoding); i++)
 						if (codeCodingLengths[i] == size) {
 							codeCoding[i] = nextCodeCoding;
+							if (nextCodeCoding >= (1 << size)) [[unlikely]] {
+								throw std::runtime_error("Corrupted data, too many Huffman codes for code lengths");
+							}
 
 							for (int code = codeCoding[i] << (8 - size); code < (codeCoding[i] + 1) << (8 - size); code++) {
 								codeCodingLookup[code] = i;
@@ -839,96 +1750,269 @@ public:
 			} else {
 				throw std::runtime_error("Unknown type of block compression");
 			}
+
+			// Called after reading the block's header, so that its codes are known
+			if (blockObserver) {
+				DeflateBlockInfo block = {blockStart, output.producedBytes(), DeflateBlockType::STORED, wasLast, output.window()};
+				std::array<uint8_t, 288> literalCodeLengths = {};
+				std::array<uint8_t, 31> distanceCodeLengths = {};
+				if (std::holds_alternative<FixedCodeState>(decodingState)) {
+					block.type = DeflateBlockType::FIXED;
+					block.literalCodeLengths = fixedLiteralCodeLengths;
+					block.distanceCodeLengths = fixedDistanceCodeLengths;
+				} else if (DynamicCodeState* state = std::get_if<DynamicCodeState>(&decodingState)) {
+					block.type = DeflateBlockType::DYNAMIC;
+					literalCodeLengths = state->codes.codeLengths();
+					distanceCodeLengths = state->distanceCode.codeLengths();
+					block.literalCodeLengths = literalCodeLengths;
+					block.distanceCodeLengths = distanceCodeLengths;
+				}
+				blockObserver(block);
+			}
 		}
 	}
 };
 
-} // namespace Detail
+// Finds the first occurrence of any of several strings, candidates are located with memchr or by checking 8 bytes at once
+class LiteralSearcher {
+	std::vector<std::string> patterns = {};
+	std::array<std::vector<int>, 256> patternsByFirstByte = {};
+	std::vector<uint8_t> firstBytes = {};
+	bool matchesEverything = false;
 
-// Handles decompression of a deflate-compressed archive, no headers
-template <DecompressionSettings Settings = DefaultDecompressionSettings>
-std::vector<char> readDeflateIntoVector(std::function<int(std::span<uint8_t> batch)> readMoreFunction) {
-	std::vector<char> result;
-	Detail::ByteInput<Settings> input(readMoreFunction);
-	Detail::ByteOutput<Settings> output;
-	Detail::DeflateReader reader(input, output);
-	bool workToDo = false;
-	do {
-		workToDo = reader.parseSome();
-		std::span<const char> batch = output.consume();
-		result.insert(result.end(), batch.begin(), batch.end());
-	} while (workToDo);
-	return result;
-}
+	static constexpr uint64_t lowestBits = 0x0101010101010101ull;
+	static constexpr uint64_t highestBits = 0x8080808080808080ull;
 
+	size_t nextCandidate(std::span<const char> data, size_t position) const {
+		if (firstBytes.size() == 1) {
+			const void* found = memchr(data.data() + position, firstBytes[0], data.size() - position);
+			return found ? static_cast<const char*>(found) - data.data() : data.size();
+		}
+		if constexpr (std::endian::native == std::endian::little) {
+			if (firstBytes.size() <= 4) {
+				// A byte of the xor with the searched byte is zero if it matched, zero bytes are detected by a carry to its highest bit
+				for ( ; position + sizeof(uint64_t) <= data.size(); position += sizeof(uint64_t)) {
+					uint64_t word = 0;
+					memcpy(&word, data.data() + position, sizeof(word));
+					uint64_t found = 0;
+					for (uint8_t searched : firstBytes) {
+						uint64_t difference = word ^ (searched * lowestBits);
+						found |= (difference - lowestBits) & ~difference & highestBits;
+					}
+					if (found) {
+						return position + (std::countr_zero(found) >> 3);
+					}
+				}
+			}
+		}
+		for ( ; position < data.size(); position++) {
+			if (!patternsByFirstByte[uint8_t(data[position])].empty())
+				return position;
+		}
+		return data.size();
+	}
+
+public:
+	LiteralSearcher(const std::vector<std::string>& searched) : patterns(searched) {
+		for (int i = 0; i < std::ssize(patterns); i++) {
+			if (patterns[i].empty()) {
+				matchesEverything = true;
+				continue;
+			}
+			std::vector<int>& sameStart = patternsByFirstByte[uint8_t(patterns[i][0])];
+			if (sameStart.empty()) {
+				firstBytes.push_back(patterns[i][0]);
+			}
+			sameStart.push_back(i);
+		}
+	}
+
+	// Returns the position of the first match and which string matched
+	std::optional<std::pair<size_t, int>> find(std::span<const char> data) const {
+		if (matchesEverything) {
+			return std::make_pair(size_t(0), int(std::find_if(patterns.begin(), patterns.end(), [] (auto& it) { return it.empty(); }) - patterns.begin()));
+		}
+		for (size_t position = nextCandidate(data, 0); position < data.size(); position = nextCandidate(data, position + 1)) {
+			for (int index : patternsByFirstByte[uint8_t(data[position])]) {
+				const std::string& pattern = patterns[index];
+				if (pattern.size() <= data.size() - position && memcmp(data.data() + position, pattern.data(), pattern.size()) == 0) {
+					return std::make_pair(position, index);
+				}
+			}
+		}
+		return std::nullopt;
+	}
+};
+
+} // namespace Detail
+
+// A file that may still be appended to, reading it waits for more data at its end instead of failing
+struct FollowFile {
+	std::string fileName;
+	std::chrono::milliseconds pollInterval = std::chrono::milliseconds(100);
+	std::function<bool()> keepWaiting = [] { return true; }; // Called before each wait, returning false causes a truncated file error
+};
+
+// Handles decompression of a deflate-compressed archive, no headers
+// The data may refer to a preset dictionary, which has to be the same as during compression
 template <DecompressionSettings Settings = DefaultDecompressionSettings>
-std::vector<char> readDeflateIntoVector(std::span<const uint8_t> allData) {
-	return readDeflateIntoVector<Settings>([allData, position = 0] (std::span<uint8_t> toFill) mutable -> int {
-		int filling = std::min(allData.size() - position, toFill.size());
-		memcpy(toFill.data(), &allData[position], filling);
-		position += filling;
-		return filling;
-	});
+std::vector<char> readDeflateIntoVector(std::function<int(std::span<uint8_t> batch)> readMoreFunction, std::span<const char> dictionary = {}) {
+	std::vector<char> result;
+	Detail::ByteInput<Settings> input(readMoreFunction);
+	Detail::ByteOutput<Settings> output;
+	output.prime(dictionary);
+	Detail::DeflateReader reader(input, output);
+	bool workToDo = false;
+	do {
+		workToDo = reader.parseSome();
+		std::span<const char> batch = output.consume();
+		result.insert(result.end(), batch.begin(), batch.end());
+	} while (workToDo || output.hasUnconsumed());
+	return result;
 }
 
-// Handles decompression of a deflate-compressed archive, no headers
 template <DecompressionSettings Settings = DefaultDecompressionSettings>
-class IDeflateArchive {
-protected:
+std::vector<char> readDeflateIntoVector(std::span<const uint8_t> allData, std::span<const char> dictionary = {}) {
+	return readDeflateIntoVector<Settings>(Detail::readFromSpan(allData), dictionary);
+}
+
+// Reads a deflate stream as the tokens it consists of, literals and repetitions, without decompressing it, for analysing or transcoding it.
+// The data of stored blocks are returned as literals. Each batch belongs to one block, described by currentBlock().
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class DeflateTokenReader {
+	struct BlockDescription {
+		DeflateBlockInfo info;
+		std::vector<uint8_t> literalCodeLengths;
+		std::vector<uint8_t> distanceCodeLengths;
+	};
+
 	Detail::ByteInput<Settings> input;
-	Detail::ByteOutput<Settings> output;
-	Detail::DeflateReader<Settings> deflateReader = {input, output};
+	Detail::TokenOutput output;
+	Detail::DeflateReader<Settings, Detail::TokenOutput> reader = {input, output};
+	std::optional<BlockDescription> current = {};
+	std::optional<BlockDescription> next = {};
 	bool done = false;
 
-	virtual void onFinish() {}
+	void observeBlocks() {
+		reader.blockObserver = [this] (const DeflateBlockInfo& block) {
+			next = BlockDescription{block, {block.literalCodeLengths.begin(), block.literalCodeLengths.end()},
+					{block.distanceCodeLengths.begin(), block.distanceCodeLengths.end()}};
+			next->info.literalCodeLengths = next->literalCodeLengths;
+			next->info.distanceCodeLengths = next->distanceCodeLengths;
+			output.pause(); // The tokens of the previous block are returned first
+		};
+	}
 
 public:
-	IDeflateArchive(std::function<int(std::span<uint8_t> batch)> readMoreFunction) : input(readMoreFunction) {}
+	DeflateTokenReader(std::function<int(std::span<uint8_t> batch)> readMoreFunction) : input(readMoreFunction) {
+		observeBlocks();
+	}
 
-	IDeflateArchive(const std::string& fileName) : input([file = std::make_shared<std::ifstream>(fileName, std::ios::binary)] (std::span<uint8_t> batch) mutable {
-		if (!file->good()) {
-			throw std::runtime_error("Can't read file");
-		}
-		file->read(reinterpret_cast<char*>(batch.data()), batch.size());
-		int bytesRead = file->gcount();
-		if (bytesRead == 0) {
-			throw std::runtime_error("Truncated file");
+	DeflateTokenReader(std::span<const uint8_t> data) : input(Detail::readFromSpan(data)) {
+		observeBlocks();
+	}
+
+	DeflateTokenReader(const DeflateTokenReader&) = delete; // The reader refers to the members
+	DeflateTokenReader& operator=(const DeflateTokenReader&) = delete;
+
+	// Returns the next tokens, empty if the block has none, valid until the next call
+	std::optional<std::span<const DeflateToken>> readSome() {
+		while (!done) {
+			bool blockStarted = false;
+			if (next) {
+				current = std::move(next);
+				next.reset();
+				blockStarted = true;
+			}
+			done = !reader.parseSome();
+			std::span<const DeflateToken> batch = output.consume();
+			if (!batch.empty() || done || (current && (blockStarted || next))) {
+				return batch;
+			}
 		}
-		return bytesRead;
-	}) {}
+		return std::nullopt;
+	}
 
-	IDeflateArchive(std::span<const uint8_t> data) : input([data] (std::span<uint8_t> batch) mutable {
-		int copying = std::min(batch.size(), data.size());
-		if (copying == 0) {
-			throw std::runtime_error("Truncated input");
+	// The block of the tokens returned by the last readSome(), its code lengths are valid until the next block starts, there is no window
+	const DeflateBlockInfo& currentBlock() const {
+		if (!current) {
+			throw std::logic_error("No block was read yet");
 		}
-		memcpy(batch.data(), data.data(), copying);
-		data = std::span<const uint8_t>(data.begin() + copying, data.end());
-		return copying;
+		return current->info;
+	}
+
+	// Number of bytes the tokens read so far would be decompressed into
+	int64_t uncompressedPosition() const {
+		return output.producedBytes();
+	}
+
+	// Number of bytes of compressed data used so far, after the end it's the size of the whole stream
+	int64_t compressedPosition() const {
+		return input.streamPosition();
+	}
+};
+
+// Decompresses many short deflate streams, like messages, reusing its buffers so that each of them costs little more than its decompression
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class DeflateMessageReader {
+	std::span<const uint8_t> message = {};
+	std::vector<char> dictionary = {};
+	Detail::ByteInput<Settings> input;
+	Detail::ByteOutput<Settings> output;
+
+public:
+	// All messages are decompressed with the same preset dictionary, if any
+	DeflateMessageReader(std::span<const char> dictionary = {}) : dictionary(dictionary.begin(), dictionary.end()), input([this] (std::span<uint8_t> toFill) {
+		int filling = std::min(message.size(), toFill.size());
+		memcpy(toFill.data(), message.data(), filling);
+		message = message.subspan(filling);
+		return filling;
 	}) {}
 
-	// Returns whether there are more bytes to read
-	std::optional<std::span<const char>> readSome(int bytesToKeep = 0) {
-		if (done) {
-			return std::nullopt;
-		}
-		bool moreStuffToDo = deflateReader.parseSome();
-		std::span<const char> batch = output.consume(bytesToKeep);
-		if (!moreStuffToDo) {
-			onFinish();
-			done = true;
-		}
-		return batch;
+	DeflateMessageReader(const DeflateMessageReader&) = delete; // The input refers to this object
+	DeflateMessageReader& operator=(const DeflateMessageReader&) = delete;
+
+	// Replaces the contents of the result, reusing its memory
+	void read(std::span<const uint8_t> compressed, std::vector<char>& result) {
+		result.clear();
+		message = compressed;
+		input.reset();
+		output.reset();
+		output.prime(dictionary);
+		Detail::DeflateReader reader(input, output);
+		bool workToDo = false;
+		do {
+			workToDo = reader.parseSome();
+			std::span<const char> batch = output.consume();
+			result.insert(result.end(), batch.begin(), batch.end());
+		} while (workToDo || output.hasUnconsumed());
+	}
+
+	std::vector<char> read(std::span<const uint8_t> compressed) {
+		std::vector<char> result;
+		read(compressed, result);
+		return result;
+	}
+};
+
+namespace Detail {
+
+// Ways of reading all data, the derived class must have readSome(bytesToKeep) and maxKeptBytes()
+template <typename Derived>
+class BatchReading {
+	Derived& self() {
+		return static_cast<Derived&>(*this);
 	}
 
+public:
 	void readByLines(const std::function<void(std::span<const char>)> reader, char separator = '\n') {
 		int keeping = 0;
 		std::span<const char> batch = {};
 		bool wasSeparator = false;
-		while (std::optional<std::span<const char>> batchOrNot = readSome(keeping)) {
-			batch = *batchOrNot;
+		while (std::optional<std::span<const char>> batchOrNot = self().readSome(keeping)) {
+			batch = std::span<const char>(batchOrNot->data() - keeping, batchOrNot->size() + keeping); // Starting with the unfinished line
 			std::span<const char>::iterator start = batch.begin();
-			for (std::span<const char>::iterator it = start; it != batch.end(); ++it) {
+			for (std::span<const char>::iterator it = start + keeping; it != batch.end(); ++it) {
 				if (wasSeparator) {
 					wasSeparator = false;
 					start = it;
@@ -948,21 +2032,465 @@ public:
 		}
 	}
 
+	// Calls the reader with each line containing any of the searched strings, stops after finding maxMatches lines if positive.
+	// Lines are numbered from 1 only if line numbers are wanted, otherwise 0 is given. Returns the number of lines found.
+	// Lines too long to be kept in the output buffer are collected separately and searched when complete.
+	int64_t readMatchingLines(const std::vector<std::string>& searched, const std::function<void(std::span<const char> line, int64_t lineNumber)>& reader,
+			int64_t maxMatches = 0, bool wantLineNumbers = false, char separator = '\n') {
+		const LiteralSearcher searcher(searched);
+		const int maxKeeping = self().maxKeptBytes();
+		int64_t found = 0;
+		int64_t lineNumber = wantLineNumbers ? 1 : 0; // Of the first line in the unsearched part
+		auto countLines = [&] (std::span<const char> part) {
+			if (wantLineNumbers)
+				lineNumber += std::count(part.begin(), part.end(), separator);
+		};
+		auto findSeparator = [separator] (std::span<const char> part) -> size_t {
+			const void* position = memchr(part.data(), separator, part.size());
+			return position ? static_cast<const char*>(position) - part.data() : part.size();
+		};
+
+		// Returns the number of bytes starting with the unfinished last line, or -1 if there are no more matches wanted
+		auto searchLines = [&] (std::span<const char> data, bool isEnd) -> int {
+			size_t lineStart = 0;
+			while (lineStart < data.size()) { // An empty pattern would match the empty rest forever
+				std::optional<std::pair<size_t, int>> match = searcher.find(data.subspan(lineStart));
+				if (!match) {
+					break;
+				}
+				size_t matchPosition = lineStart + match->first;
+				size_t lineEnd = matchPosition + findSeparator(data.subspan(matchPosition));
+				if (lineEnd == data.size() && !isEnd) {
+					break; // Searched again when the line is complete
+				}
+				size_t matchLineStart = matchPosition;
+				while (matchLineStart > lineStart && data[matchLineStart - 1] != separator)
+					matchLineStart--;
+				countLines(data.subspan(lineStart, matchLineStart - lineStart));
+				reader(data.subspan(matchLineStart, lineEnd - matchLineStart), lineNumber);
+				found++;
+				if (maxMatches > 0 && found >= maxMatches) {
+					return -1;
+				}
+				if (wantLineNumbers)
+					lineNumber++;
+				lineStart = std::min(lineEnd + 1, data.size());
+			}
+			size_t unfinished = data.size();
+			while (unfinished > lineStart && data[unfinished - 1] != separator)
+				unfinished--;
+			countLines(data.subspan(lineStart, unfinished - lineStart));
+			return data.size() - unfinished;
+		};
+
+		int keeping = 0;
+		std::span<const char> data = {};
+		std::vector<char> longLine; // Unfinished line that didn't fit into the kept part of the buffer, with its separator once complete
+		while (std::optional<std::span<const char>> batch = self().readSome(keeping)) {
+			data = std::span<const char>(batch->data() - keeping, batch->size() + keeping);
+			if (!longLine.empty()) {
+				size_t lineEnd = findSeparator(data);
+				longLine.insert(longLine.end(), data.begin(), data.begin() + std::min(lineEnd + 1, data.size()));
+				if (lineEnd == data.size()) {
+					keeping = 0;
+					continue;
+				}
+				if (searchLines(longLine, true) < 0) {
+					return found;
+				}
+				longLine.clear();
+				data = data.subspan(lineEnd + 1);
+			}
+			keeping = searchLines(data, false);
+			if (keeping < 0) {
+				return found;
+			}
+			if (keeping > maxKeeping) {
+				longLine.assign(data.end() - keeping, data.end());
+				keeping = 0;
+			}
+		}
+		if (!longLine.empty()) {
+			searchLines(longLine, true);
+		} else if (keeping > 0) {
+			searchLines(data.subspan(data.size() - keeping), true);
+		}
+		return found;
+	}
+
 	void readAll(const std::function<void(std::span<const char>)>& reader) {
-		while (std::optional<std::span<const char>> batch = readSome()) {
+		while (std::optional<std::span<const char>> batch = self().readSome()) {
 			reader(*batch);
 		}
 	}
 
 	std::vector<char> readAll() {
 		std::vector<char> returned;
-		while (std::optional<std::span<const char>> batch = readSome()) {
+		while (std::optional<std::span<const char>> batch = self().readSome()) {
 			returned.insert(returned.end(), batch->begin(), batch->end());
 		};
 		return returned;
 	}
 };
 
+} // namespace Detail
+
+// Handles decompression of a deflate-compressed archive, no headers
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class IDeflateArchive : public Detail::BatchReading<IDeflateArchive<Settings>> {
+protected:
+	Detail::ByteInput<Settings> input;
+	Detail::ByteOutput<Settings> output;
+	Detail::DeflateReader<Settings> deflateReader = {input, output};
+	bool done = false;
+	bool dictionaryMissing = false;
+	constexpr static uint32_t savedStateMagic = 0x31535a45; // EZS1
+
+	virtual void onFinish() {}
+
+	// Files and memory can be seeked in, which makes restoreState() faster
+	IDeflateArchive(std::shared_ptr<std::ifstream> file, const BufferSizes& sizes) : input([file] (std::span<uint8_t> batch) mutable {
+		if (!file->is_open()) {
+			throw std::runtime_error("Can't read file");
+		}
+		if (file->eof()) {
+			return 0; // Reading past the end is detected by the decoder, there may be nothing more to read
+		}
+		file->read(reinterpret_cast<char*>(batch.data()), batch.size());
+		return int(file->gcount());
+	}, {}, sizes.inputBufferSize), output(sizes) {
+		input.setSeeking([file] (int64_t position) {
+			file->clear();
+			file->seekg(position);
+		});
+	}
+
+	IDeflateArchive(std::span<const uint8_t> data, std::shared_ptr<size_t> position, const BufferSizes& sizes) : input([data, position] (std::span<uint8_t> batch) {
+		int copying = std::min(batch.size(), data.size() - std::min(*position, data.size()));
+		memcpy(batch.data(), data.data() + *position, copying);
+		*position += copying;
+		return copying;
+	}, {}, sizes.inputBufferSize), output(sizes) {
+		input.setSeeking([position] (int64_t target) {
+			*position = target;
+		});
+	}
+
+public:
+	// The buffer sizes can be set only if the settings have runtimeBufferSizes set to true
+	IDeflateArchive(std::function<int(std::span<uint8_t> batch)> readMoreFunction, const BufferSizes& sizes = BufferSizes::of<Settings>())
+		: input(readMoreFunction, {}, sizes.inputBufferSize), output(sizes) {}
+
+	// The first function returns 0 if no data is available at the moment, the second one waits until there might be more and returns false if there won't be
+	IDeflateArchive(std::function<int(std::span<uint8_t> batch)> readMoreFunction, std::function<bool()> waitForMoreFunction,
+			const BufferSizes& sizes = BufferSizes::of<Settings>())
+		: input(readMoreFunction, waitForMoreFunction, sizes.inputBufferSize), output(sizes) {}
+
+	IDeflateArchive(const std::string& fileName, const BufferSizes& sizes = BufferSizes::of<Settings>())
+			: IDeflateArchive(std::make_shared<std::ifstream>(fileName, std::ios::binary), sizes) {}
+
+	IDeflateArchive(const FollowFile& followed, const BufferSizes& sizes = BufferSizes::of<Settings>()) : input([file = std::make_shared<std::ifstream>(followed.fileName, std::ios::binary)] (std::span<uint8_t> batch) mutable {
+		if (!file->is_open()) {
+			throw std::runtime_error("Can't read file");
+		}
+		file->clear(); // Reaching the end of the file the last time doesn't mean nothing was appended since
+		file->read(reinterpret_cast<char*>(batch.data()), batch.size());
+		return int(file->gcount());
+	}, [followed] {
+		if (!followed.keepWaiting()) {
+			throw std::runtime_error("Truncated file");
+		}
+		std::this_thread::sleep_for(followed.pollInterval);
+		return true;
+	}, sizes.inputBufferSize), output(sizes) {}
+
+	IDeflateArchive(std::span<const uint8_t> data, const BufferSizes& sizes = BufferSizes::of<Settings>())
+			: IDeflateArchive(data, std::make_shared<size_t>(0), sizes) {}
+
+	// Makes readSome() return after decompressing at most the given number of bytes, or sooner if the input has to wait for more data
+	// Waiting for input is detected only when reading a FollowFile or with a source that has a function for waiting
+	void setLowLatency(int maxBatchSize) {
+		output.setBatchLimit(maxBatchSize);
+		input.setStarvingHandler([this] {
+			output.pause();
+		});
+	}
+
+	// The checksum from the settings, it was updated with all data returned so far
+	typename Settings::Checksum& checksum() {
+		return output.getChecksum();
+	}
+
+	// The function is called whenever a deflate block starts, for example to build an index for random access
+	void setBlockObserver(std::function<void(const DeflateBlockInfo&)> observer) {
+		deflateReader.blockObserver = std::move(observer);
+	}
+
+	// Saves what's needed to continue decompressing from the current position, about 33 kiB
+	// It can be used to continue later with restoreState() on the same compressed data, without decompressing what came before
+	std::vector<uint8_t> saveState() {
+		std::vector<uint8_t> saved;
+		Detail::appendLittleEndian<uint32_t>(saved, savedStateMagic);
+		deflateReader.saveState(saved);
+		output.saveState(saved);
+		return saved;
+	}
+
+	// Must be called before decompressing anything, the input must be the same (only seekable sources can skip the data quickly)
+	void restoreState(std::span<const uint8_t> saved) {
+		if (output.producedBytes() > 0 || done) {
+			throw std::logic_error("Decompression state can be restored only before decompressing");
+		}
+		Detail::SavedStateReader reader = {saved};
+		if (reader.get<uint32_t>() != savedStateMagic) {
+			throw std::runtime_error("Not a saved decompression state");
+		}
+		deflateReader.restoreState(reader);
+		output.restoreState(reader);
+		dictionaryMissing = false; // The dictionary is a part of the saved history
+	}
+
+	// Continues from a block start remembered in an index, like restoreState() but the checksum covers only the data that follows
+	void restoreCheckpoint(const DeflateCheckpoint& checkpoint) {
+		if (output.producedBytes() > 0 || done) {
+			throw std::logic_error("Decompression can continue from a checkpoint only before decompressing");
+		}
+		deflateReader.startBlockAt(checkpoint.compressedBitOffset);
+		output.restoreWindow(checkpoint.uncompressedOffset, checkpoint.window);
+		dictionaryMissing = false;
+	}
+
+	// Makes the data refer to a preset dictionary, it has to be the same as during compression and must be set before reading
+	virtual void setDictionary(std::span<const char> dictionary) {
+		if (output.producedBytes() > 0) {
+			throw std::logic_error("Dictionary must be set before decompressing");
+		}
+		output.prime(dictionary);
+		dictionaryMissing = false;
+	}
+
+	// Returns whether there are more bytes to read
+	std::optional<std::span<const char>> readSome(int bytesToKeep = 0) {
+		if (done) {
+			return std::nullopt;
+		}
+		if (dictionaryMissing) [[unlikely]] {
+			throw std::runtime_error("The stream needs a preset dictionary, it must be given to setDictionary()");
+		}
+		bool moreStuffToDo = deflateReader.parseSome();
+		std::span<const char> batch = output.consume(bytesToKeep);
+		if (!moreStuffToDo && !output.hasUnconsumed()) {
+			onFinish();
+			done = true;
+		}
+		return batch;
+	}
+
+	// Longest unfinished part of data that readMatchingLines keeps for the next batch
+	int maxKeptBytes() const {
+		return output.maxKept();
+	}
+
+	// Number of bytes of compressed data used so far, after the end it's the size of the whole stream
+	int64_t compressedPosition() const {
+		return input.streamPosition();
+	}
+};
+
+// Checkpoints for decompressing parts of a deflate stream independently, they can be collected during any reading
+struct DeflateIndex {
+	std::vector<DeflateCheckpoint> checkpoints;
+
+	// Returns a block observer that adds a checkpoint whenever at least the given number of bytes was decompressed since the previous one
+	std::function<void(const DeflateBlockInfo&)> observer(int64_t spacing = 4 * 1024 * 1024) {
+		return [this, spacing] (const DeflateBlockInfo& block) {
+			if (!checkpoints.empty() && block.uncompressedOffset - checkpoints.back().uncompressedOffset < std::max<int64_t>(spacing, 1)) {
+				return;
+			}
+			if (std::ssize(block.window) < std::min<int64_t>(block.uncompressedOffset, 32768)) {
+				return; // A circular output buffer doesn't always have the whole window in one piece, a later block will do
+			}
+			checkpoints.push_back({block.compressedBitOffset, block.uncompressedOffset, std::vector<char>(block.window.begin(), block.window.end())});
+		};
+	}
+
+	std::vector<uint8_t> save() const {
+		std::vector<uint8_t> saved;
+		Detail::appendLittleEndian<uint32_t>(saved, magic);
+		Detail::appendLittleEndian<uint32_t>(saved, checkpoints.size());
+		for (const DeflateCheckpoint& checkpoint : checkpoints) {
+			Detail::appendLittleEndian<int64_t>(saved, checkpoint.compressedBitOffset);
+			Detail::appendLittleEndian<int64_t>(saved, checkpoint.uncompressedOffset);
+			Detail::appendLittleEndian<uint16_t>(saved, checkpoint.window.size());
+			saved.insert(saved.end(), checkpoint.window.begin(), checkpoint.window.end());
+		}
+		return saved;
+	}
+
+	static DeflateIndex load(std::span<const uint8_t> saved) {
+		Detail::SavedStateReader reader = {saved};
+		if (reader.get<uint32_t>() != magic) {
+			throw std::runtime_error("Not a deflate index");
+		}
+		DeflateIndex index;
+		uint32_t count = reader.get<uint32_t>();
+		for (uint32_t i = 0; i < count; i++) {
+			DeflateCheckpoint& checkpoint = index.checkpoints.emplace_back();
+			checkpoint.compressedBitOffset = reader.get<int64_t>();
+			checkpoint.uncompressedOffset = reader.get<int64_t>();
+			std::span<const uint8_t> window = reader.getBytes(reader.get<uint16_t>());
+			checkpoint.window.assign(window.begin(), window.end());
+			if (i > 0 && checkpoint.uncompressedOffset <= index.checkpoints[i - 1].uncompressedOffset) [[unlikely]] {
+				throw std::runtime_error("Corrupted deflate index, checkpoints aren't in order");
+			}
+		}
+		return index;
+	}
+
+private:
+	constexpr static uint32_t magic = 0x31495a45; // EZI1
+};
+
+// Decompresses the parts between the checkpoints of an index on multiple threads, the data are returned in order
+// Each part is returned as one batch, so the checkpoints' spacing determines the memory used
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class ParallelDeflateReader : public Detail::BatchReading<ParallelDeflateReader<Settings>> {
+	struct SegmentSettings : Settings {
+		using Checksum = NoChecksum; // The parts don't start at the beginning, the checksum is computed as they are returned
+	};
+	constexpr static int keptSpace = 32768; // Space before each part for the bytes kept from the previous one
+
+	// Reads the gzip trailer after the last part if the stream is in a gzip file
+	class Segment : public IDeflateArchive<SegmentSettings> {
+		using Deflate = IDeflateArchive<SegmentSettings>;
+
+		void onFinish() override {
+			if (readsTrailer) {
+				expectedCrc = Deflate::input.template getInteger<uint32_t>();
+				expectedSize = Deflate::input.template getInteger<uint32_t>();
+			}
+		}
+
+	public:
+		using Deflate::Deflate;
+		bool readsTrailer = false;
+		uint32_t expectedCrc = 0;
+		uint32_t expectedSize = 0;
+
+		// Can be called only before reading anything
+		bool startsWithGzipHeader() {
+			std::span<const uint8_t> start = Deflate::input.getRange(2);
+			return start.size() == 2 && start[0] == 0x1f && start[1] == 0x8b;
+		}
+	};
+
+	std::function<std::unique_ptr<Segment>()> openInput;
+	std::vector<DeflateCheckpoint> checkpoints;
+	int threads = 1;
+	bool gzip = false;
+	int started = 0;
+	std::queue<std::future<std::vector<char>>> decompressing;
+	std::vector<char> current;
+	typename Settings::Checksum checksumState = {};
+	int64_t returnedBytes = 0;
+	uint32_t expectedCrc = 0; // From the trailer, set by the last part
+	uint32_t expectedSize = 0;
+
+	std::vector<char> decompressSegment(int index) {
+		std::unique_ptr<Segment> archive = openInput();
+		archive->restoreCheckpoint(checkpoints[index]);
+		const bool isLast = (index + 1 == std::ssize(checkpoints));
+		archive->readsTrailer = isLast && gzip;
+		const int64_t size = isLast ? std::numeric_limits<int64_t>::max()
+				: checkpoints[index + 1].uncompressedOffset - checkpoints[index].uncompressedOffset;
+		std::vector<char> result(keptSpace);
+		if (!isLast) {
+			result.reserve(keptSpace + size);
+		}
+		while (std::ssize(result) - keptSpace < size) {
+			std::optional<std::span<const char>> batch = archive->readSome();
+			if (!batch) {
+				if (!isLast) {
+					throw std::runtime_error("The deflate index doesn't match the data");
+				}
+				break;
+			}
+			int64_t taking = std::min<int64_t>(batch->size(), size - (std::ssize(result) - keptSpace));
+			result.insert(result.end(), batch->begin(), batch->begin() + taking);
+		}
+		if (isLast) {
+			expectedCrc = archive->expectedCrc; // Read by the caller only after the part is returned
+			expectedSize = archive->expectedSize;
+		}
+		return result;
+	}
+
+	void verifyTrailer() {
+		if constexpr (Settings::verifyChecksum) {
+			if (expectedCrc != checksumState())
+				throw std::runtime_error("Gzip archive's crc32 checksum doesn't match the calculated checksum");
+			if (expectedSize != uint32_t(returnedBytes))
+				throw std::runtime_error("Gzip archive's size doesn't match the size of the decompressed data");
+		}
+	}
+
+	void startMore() {
+		while (std::ssize(decompressing) < threads && started < std::ssize(checkpoints)) {
+			decompressing.push(std::async(std::launch::async, [this, index = started] {
+				return decompressSegment(index);
+			}));
+			started++;
+		}
+	}
+
+public:
+	// Zero threads means one per processor core
+	// The data can be raw deflate or a gzip file, the gzip trailer is verified after the last part
+	ParallelDeflateReader(const std::string& fileName, DeflateIndex index, int threads = 0) : openInput([fileName] {
+		return std::make_unique<Segment>(fileName);
+	}), checkpoints(std::move(index.checkpoints)), threads(threads > 0 ? threads : std::max<int>(1, std::thread::hardware_concurrency())),
+			gzip(openInput()->startsWithGzipHeader()) {}
+
+	ParallelDeflateReader(std::span<const uint8_t> data, DeflateIndex index, int threads = 0) : openInput([data] {
+		return std::make_unique<Segment>(data);
+	}), checkpoints(std::move(index.checkpoints)), threads(threads > 0 ? threads : std::max<int>(1, std::thread::hardware_concurrency())),
+			gzip(openInput()->startsWithGzipHeader()) {}
+
+	// Returns whether there are more bytes to read
+	std::optional<std::span<const char>> readSome(int bytesToKeep = 0) {
+		if (bytesToKeep > keptSpace || bytesToKeep > std::ssize(current)) [[unlikely]] {
+			throw std::logic_error("readSome() cannot keep more bytes than it provided before or more than 32 kiB");
+		}
+		startMore();
+		if (decompressing.empty()) {
+			return std::nullopt;
+		}
+		std::vector<char> next = decompressing.front().get();
+		decompressing.pop();
+		startMore();
+		if (bytesToKeep > 0) {
+			memcpy(next.data() + keptSpace - bytesToKeep, current.data() + current.size() - bytesToKeep, bytesToKeep);
+		}
+		current = std::move(next);
+		std::span<const char> batch(current.data() + keptSpace, current.size() - keptSpace);
+		checksumState(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(batch.data()), batch.size()));
+		returnedBytes += batch.size();
+		if (gzip && decompressing.empty()) {
+			verifyTrailer();
+		}
+		return batch;
+	}
+
+	int maxKeptBytes() const {
+		return keptSpace;
+	}
+
+	// The checksum from the settings, it was updated with all data returned so far
+	typename Settings::Checksum& checksum() {
+		return checksumState;
+	}
+};
+
 enum class CreatingOperatingSystem {
 	UNIX_BASED,
 	WINDOWS,
@@ -979,6 +2507,7 @@ struct IGzFileInfo {
 	std::string name;
 	std::string comment;
 	bool probablyText = false;
+	int headerSize = 0; // Where the compressed data start
 
 	template <DecompressionSettings Settings>
 	IGzFileInfo(Detail::ByteInput<Settings>& input) {
@@ -1012,6 +2541,7 @@ struct IGzFileInfo {
 		} else if (creatingOperatingSystem == 3) {
 			operatingSystem = CreatingOperatingSystem::UNIX_BASED;
 		}
+		headerSize = 10;
 
 		if (flags & 0x04) {
 			uint16_t extraHeaderSize = input.template getInteger<uint16_t>();
@@ -1024,23 +2554,28 @@ struct IGzFileInfo {
 				extraData->insert(extraData->end(), taken.begin(), taken.end());
 				readSoFar += taken.size();
 			}
+			headerSize += 2 + extraHeaderSize;
 		}
 		if (flags & 0x08) {
 			char letter = input.template getInteger<uint8_t>();
 			check(letter);
+			headerSize++;
 			while (letter != '\0') {
 				name += letter;
 				letter = input.template getInteger<uint8_t>();
 				check(letter);
+				headerSize++;
 			}
 		}
 		if (flags & 0x10) {
 			char letter = input.template getInteger<uint8_t>();
 			check(letter);
+			headerSize++;
 			while (letter != '\0') {
 				name += letter;
 				letter = input.template getInteger<uint8_t>();
 				check(letter);
+				headerSize++;
 			}
 		}
 		if (flags & 0x01) {
@@ -1049,6 +2584,7 @@ struct IGzFileInfo {
 		if (flags & 0x02) {
 			uint16_t expectedHeaderCrc = input.template getInteger<uint16_t>();
 			check(expectedHeaderCrc);
+			headerSize += 2;
 			uint16_t realHeaderCrc = checksum();
 			if (expectedHeaderCrc != realHeaderCrc)
 				throw std::runtime_error("Gzip archive's headers crc32 checksum doesn't match the actual header's checksum");
@@ -1062,29 +2598,228 @@ class IGzFile : public IDeflateArchive<Settings> {
 	IGzFileInfo parsedHeader;
 	using Deflate = IDeflateArchive<Settings>;
 
+	// Random access to the file's contents, only possible if it's a dictzip file that is in memory or in a file
+	std::function<void(int64_t offset, std::span<uint8_t> batch)> readCompressedAt = {};
+	std::vector<int64_t> chunkOffsets = {}; // Positions of chunks in the file, one more than the number of chunks
+	int chunkLength = 0;
+
 	void onFinish() override {
 		uint32_t expectedCrc = Deflate::input.template getInteger<uint32_t>();
+		uint32_t expectedSize = Deflate::input.template getInteger<uint32_t>();
 		if constexpr(Settings::verifyChecksum) {
 			auto realCrc = Deflate::output.getChecksum()();
 			if (expectedCrc != realCrc)
 				throw std::runtime_error("Gzip archive's crc32 checksum doesn't match the calculated checksum");
+			if (expectedSize != uint32_t(Deflate::output.producedBytes()))
+				throw std::runtime_error("Gzip archive's size doesn't match the size of the decompressed data");
 		}
 	}
 
-public:
-	IGzFile(std::function<int(std::span<uint8_t> batch)> readMoreFunction) : Deflate(readMoreFunction), parsedHeader(Deflate::input) {}
-	IGzFile(const std::string& fileName) : Deflate(fileName), parsedHeader(Deflate::input) {}
-	IGzFile(std::span<const uint8_t> data) : Deflate(data), parsedHeader(Deflate::input) {}
+	// The dictzip format stores a table of compressed sizes of chunks in an extra field with ID RA, each chunk ends with a full flush
+	void parseRandomAccessField() {
+		if (!parsedHeader.extraData.has_value()) {
+			return;
+		}
+		std::span<const uint8_t> extra = *parsedHeader.extraData;
+		for (size_t position = 0; position + 4 <= extra.size(); ) {
+			int fieldSize = Detail::readLittleEndian<uint16_t>(extra, position + 2);
+			if (extra[position] == 'R' && extra[position + 1] == 'A') {
+				std::span<const uint8_t> field = extra.subspan(position + 4, std::min<size_t>(fieldSize, extra.size() - position - 4));
+				if (Detail::readLittleEndian<uint16_t>(field, 0) != 1) {
+					throw std::runtime_error("Unsupported version of dictzip random access field");
+				}
+				chunkLength = Detail::readLittleEndian<uint16_t>(field, 2);
+				if (chunkLength == 0) {
+					throw std::runtime_error("Dictzip random access field declares empty chunks");
+				}
+				int chunkCount = Detail::readLittleEndian<uint16_t>(field, 4);
+				chunkOffsets.push_back(parsedHeader.headerSize);
+				for (int i = 0; i < chunkCount; i++) {
+					chunkOffsets.push_back(chunkOffsets.back() + Detail::readLittleEndian<uint16_t>(field, 6 + i * 2));
+				}
+				return;
+			}
+			position += 4 + fieldSize;
+		}
+	}
+
+	// With runtime buffer sizes, they are chosen by the file's size and the uncompressed size in its last 4 bytes
+	static BufferSizes suitableSizes(int64_t compressedSize, std::span<const uint8_t> lastBytes) {
+		if constexpr (!hasRuntimeBufferSizes<Settings>()) {
+			return BufferSizes::of<Settings>();
+		}
+		std::optional<int64_t> uncompressedSize;
+		if (lastBytes.size() == sizeof(uint32_t)) {
+			uncompressedSize = Detail::readLittleEndian<uint32_t>(lastBytes, 0);
+		}
+		return BufferSizes::forInputSize(compressedSize, uncompressedSize);
+	}
+
+	static BufferSizes suitableSizes(const std::string& fileName) {
+		if constexpr (!hasRuntimeBufferSizes<Settings>()) {
+			return BufferSizes::of<Settings>();
+		}
+		std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+		int64_t size = file.is_open() ? int64_t(file.tellg()) : 0;
+		std::array<uint8_t, sizeof(uint32_t)> lastBytes = {};
+		if (size >= 18) { // Smallest possible gzip file
+			file.seekg(size - lastBytes.size());
+			file.read(reinterpret_cast<char*>(lastBytes.data()), lastBytes.size());
+		}
+		return suitableSizes(size, std::span<const uint8_t>(lastBytes).first(size >= 18 ? lastBytes.size() : 0));
+	}
+
+public:
+	// Buffer sizes can be set only if the settings have runtimeBufferSizes set to true, if not set, they are chosen by the file's size
+	IGzFile(std::function<int(std::span<uint8_t> batch)> readMoreFunction, const BufferSizes& sizes = BufferSizes::of<Settings>())
+			: Deflate(readMoreFunction, sizes), parsedHeader(Deflate::input) {
+		parseRandomAccessField();
+	}
+	IGzFile(std::function<int(std::span<uint8_t> batch)> readMoreFunction, std::function<bool()> waitForMoreFunction,
+			const BufferSizes& sizes = BufferSizes::of<Settings>()) : Deflate(readMoreFunction, waitForMoreFunction, sizes), parsedHeader(Deflate::input) {
+		parseRandomAccessField();
+	}
+	IGzFile(const std::string& fileName, std::optional<BufferSizes> sizes = std::nullopt)
+			: Deflate(fileName, sizes ? *sizes : suitableSizes(fileName)), parsedHeader(Deflate::input) {
+		parseRandomAccessField();
+		readCompressedAt = [fileName, file = std::shared_ptr<std::ifstream>()] (int64_t offset, std::span<uint8_t> batch) mutable {
+			if (!file) {
+				file = std::make_shared<std::ifstream>(fileName, std::ios::binary);
+			}
+			file->seekg(offset);
+			file->read(reinterpret_cast<char*>(batch.data()), batch.size());
+			if (file->gcount() != std::ssize(batch)) {
+				throw std::runtime_error("Truncated file");
+			}
+		};
+	}
+	// Reads a file that is still being written into, waiting whenever reaching its end
+	IGzFile(const FollowFile& followed, const BufferSizes& sizes = BufferSizes::of<Settings>()) : Deflate(followed, sizes), parsedHeader(Deflate::input) {
+		parseRandomAccessField();
+	}
+	IGzFile(std::span<const uint8_t> data, std::optional<BufferSizes> sizes = std::nullopt)
+			: Deflate(data, sizes ? *sizes : suitableSizes(data.size(), data.size() >= 18 ? data.last(sizeof(uint32_t)) : data.first(0))),
+			parsedHeader(Deflate::input) {
+		parseRandomAccessField();
+		readCompressedAt = [data] (int64_t offset, std::span<uint8_t> batch) {
+			if (offset + batch.size() > data.size()) {
+				throw std::runtime_error("Truncated input");
+			}
+			memcpy(batch.data(), &data[offset], batch.size());
+		};
+	}
 
 	const IGzFileInfo& info() const {
 		return parsedHeader;
 	}
+
+	// True if it's a dictzip file and readAt() can be used
+	bool hasRandomAccess() const {
+		return !chunkOffsets.empty() && readCompressedAt;
+	}
+
+	// Decompresses only the chunks of a dictzip file that contain the range, independent of reading through readSome()
+	std::vector<char> readAt(int64_t offset, int64_t length) {
+		if (!hasRandomAccess()) {
+			throw std::runtime_error("Random access is possible only with dictzip files read from a file or memory");
+		}
+		if (offset < 0 || length < 0 || length > std::numeric_limits<int64_t>::max() - offset) {
+			throw std::logic_error("Reading a range with a negative offset or length");
+		}
+		std::vector<char> result;
+		const int64_t chunkCount = std::ssize(chunkOffsets) - 1;
+		std::vector<uint8_t> compressed;
+		for (int64_t chunk = offset / chunkLength; chunk < chunkCount && chunk * chunkLength < offset + length; chunk++) {
+			// The chunk ends at a byte boundary, an empty final block is appended to end the stream there
+			compressed.resize(chunkOffsets[chunk + 1] - chunkOffsets[chunk]);
+			readCompressedAt(chunkOffsets[chunk], compressed);
+			compressed.insert(compressed.end(), {0x03, 0x00});
+			std::vector<char> decompressed = readDeflateIntoVector<Settings>(compressed);
+			int64_t start = std::max<int64_t>(offset - chunk * chunkLength, 0);
+			int64_t end = std::min<int64_t>(offset + length - chunk * chunkLength, decompressed.size());
+			if (start < end) {
+				result.insert(result.end(), decompressed.begin() + start, decompressed.begin() + end);
+			}
+		}
+		return result;
+	}
 };
 
 namespace Detail {
+// Zlib streams use a different checksum than gzip files
+template <DecompressionSettings Settings>
+struct ZlibSettings : Settings {
+	using Checksum = std::conditional_t<Settings::verifyChecksum, Adler32, NoChecksum>;
+};
+}
+
+// Parses a zlib stream, it has a two byte header before the deflate data and an Adler-32 checksum after it
 template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class IZlibFile : public IDeflateArchive<Detail::ZlibSettings<Settings>> {
+	using Deflate = IDeflateArchive<Detail::ZlibSettings<Settings>>;
+
+	void parseHeader() {
+		uint8_t method = Deflate::input.template getInteger<uint8_t>();
+		uint8_t flags = Deflate::input.template getInteger<uint8_t>();
+		if (!isZlibHeader(method, flags)) {
+			throw std::runtime_error("Trying to parse something that isn't a zlib stream");
+		}
+		if (flags & 0x20) {
+			dictionaryId = 0;
+			for (int i = 0; i < 4; i++) {
+				*dictionaryId = (*dictionaryId << 8) | Deflate::input.template getInteger<uint8_t>();
+			}
+			Deflate::dictionaryMissing = true;
+		}
+	}
+
+	std::optional<uint32_t> dictionaryId = {}; // Adler-32 of the preset dictionary
+
+	void onFinish() override {
+		uint32_t expected = 0; // Big endian, unlike everything else
+		for (int i = 0; i < 4; i++) {
+			expected = (expected << 8) | Deflate::input.template getInteger<uint8_t>();
+		}
+		if constexpr (Settings::verifyChecksum) {
+			if (expected != Deflate::output.getChecksum()())
+				throw std::runtime_error("Zlib stream's Adler-32 checksum doesn't match the calculated checksum");
+		}
+	}
+
+public:
+	// Deflate compression with a window of at most 32 kiB and a header checksum
+	static bool isZlibHeader(uint8_t method, uint8_t flags) {
+		return (method & 0x0f) == 8 && (method >> 4) <= 7 && ((method << 8) | flags) % 31 == 0;
+	}
+
+	IZlibFile(std::function<int(std::span<uint8_t> batch)> readMoreFunction, const BufferSizes& sizes = BufferSizes::of<Settings>())
+			: Deflate(readMoreFunction, sizes) {
+		parseHeader();
+	}
+	IZlibFile(const std::string& fileName, const BufferSizes& sizes = BufferSizes::of<Settings>()) : Deflate(fileName, sizes) {
+		parseHeader();
+	}
+	IZlibFile(std::span<const uint8_t> data, const BufferSizes& sizes = BufferSizes::of<Settings>()) : Deflate(data, sizes) {
+		parseHeader();
+	}
+
+	// The Adler-32 checksum of the dictionary the stream needs, if it needs one
+	std::optional<uint32_t> requiredDictionary() const {
+		return dictionaryId;
+	}
+
+	void setDictionary(std::span<const char> dictionary) override {
+		if (!dictionaryId || Adler32()(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(dictionary.data()), dictionary.size())) != *dictionaryId) {
+			throw std::runtime_error("The preset dictionary isn't the one the zlib stream was compressed with");
+		}
+		Deflate::setDictionary(dictionary);
+	}
+};
+
+namespace Detail {
+template <DecompressionSettings Settings = DefaultDecompressionSettings, typename File = IGzFile<Settings>>
 class IGzStreamBuffer : public std::streambuf {
-	IGzFile<Settings> inputFile;
+	File inputFile;
 	int bytesToKeep = 10;
 	ssize_t produced = 0;
 public:
@@ -1093,6 +2828,9 @@ public:
 
 	int underflow() override {
 		std::optional<std::span<const char>> batch = inputFile.readSome(bytesToKeep);
+		while (batch.has_value() && batch->empty()) { // A batch can be empty if the output buffer filled up in the middle of a copy
+			batch = inputFile.readSome(bytesToKeep);
+		}
 		if (batch.has_value()) {
 			// We have to believe std::istream that it won't edit the data, otherwise it would be necessary to copy the data
 			char* start = const_cast<char*>(batch->data());
@@ -1107,6 +2845,10 @@ public:
 	const IGzFileInfo& info() const {
 		return inputFile.info();
 	}
+
+	const File& file() const {
+		return inputFile;
+	}
 };
 }
 
@@ -1117,6 +2859,8 @@ class BasicIGzStream : private Detail::IGzStreamBuffer<Settings>, public std::is
 public:
 	// Open and read a file, always keeping the given number of characters specified in the second character (10 by default)
 	BasicIGzStream(const std::string& sourceFile, int bytesToKeep = 10) : Detail::IGzStreamBuffer<Settings>(sourceFile, bytesToKeep), std::istream(this) {}
+	// Open a file that is still being written into and wait for its end
+	BasicIGzStream(const FollowFile& followed, int bytesToKeep = 10) : Detail::IGzStreamBuffer<Settings>(followed, bytesToKeep), std::istream(this) {}
 	// Read from a buffer
 	BasicIGzStream(std::span<const uint8_t> data, int bytesToKeep = 10) : Detail::IGzStreamBuffer<Settings>(data, bytesToKeep),  std::istream(this) {}
 	// Use a function that fills a buffer of data and returns how many bytes it wrote
@@ -1133,6 +2877,2699 @@ public:
 // Most obvious usage, default settings
 using IGzStream = BasicIGzStream<>;
 
+// Reads several .gz files one after another as if they were one file, the next file is opened on another thread while the current one is read
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class IGzMultiFile : public Detail::BatchReading<IGzMultiFile<Settings>> {
+	using Opener = std::function<std::unique_ptr<IGzFile<Settings>>()>;
+	std::vector<Opener> openers;
+	int nextIndex = 0;
+	std::unique_ptr<IGzFile<Settings>> current = {};
+	std::future<std::unique_ptr<IGzFile<Settings>>> upcoming = {};
+
+	// The data before the first batches of a file are in the previous file, they are copied here to remain accessible
+	std::vector<char> seam = {};
+	std::span<const char> lastBatch = {};
+	int64_t produced = 0;
+	int64_t producedInFile = 0;
+
+	void prefetch() {
+		if (nextIndex < std::ssize(openers)) {
+			upcoming = std::async(std::launch::async, openers[nextIndex]);
+			nextIndex++;
+		}
+	}
+
+	void openNext() {
+		current = upcoming.valid() ? upcoming.get() : nullptr;
+		producedInFile = 0;
+		prefetch();
+	}
+
+	template <typename Source>
+	IGzMultiFile(const std::vector<Source>& sources, int) {
+		for (const Source& source : sources) {
+			openers.push_back([source] {
+				return std::make_unique<IGzFile<Settings>>(source);
+			});
+		}
+		prefetch();
+		openNext();
+	}
+
+public:
+	IGzMultiFile(const std::vector<std::string>& fileNames) : IGzMultiFile(fileNames, 0) {}
+	IGzMultiFile(std::initializer_list<std::string> fileNames) : IGzMultiFile(std::vector<std::string>(fileNames), 0) {}
+	IGzMultiFile(const std::vector<std::function<int(std::span<uint8_t> batch)>>& readMoreFunctions) : IGzMultiFile(readMoreFunctions, 0) {}
+
+	// Returns whether there are more bytes to read, the kept bytes may come from the previous file
+	std::optional<std::span<const char>> readSome(int bytesToKeep = 0) {
+		while (current) {
+			const int64_t keeping = std::min<int64_t>(bytesToKeep, produced);
+			std::vector<char> kept;
+			if (keeping > producedInFile) {
+				kept.assign(lastBatch.end() - keeping, lastBatch.end()); // Must be copied before the file's buffer is changed
+			}
+			std::optional<std::span<const char>> batch = current->readSome(bytesToKeep);
+			if (!batch.has_value()) {
+				if (keeping > 0) {
+					seam.assign(lastBatch.end() - keeping, lastBatch.end());
+					lastBatch = std::span<const char>(seam.data() + seam.size(), 0);
+				}
+				openNext();
+				continue;
+			}
+			if (!kept.empty()) {
+				kept.insert(kept.end(), batch->begin(), batch->end());
+				seam = std::move(kept);
+				batch = std::span<const char>(seam.data() + seam.size() - batch->size(), batch->size());
+			}
+			produced += batch->size();
+			producedInFile += batch->size();
+			lastBatch = *batch;
+			return batch;
+		}
+		return std::nullopt;
+	}
+
+	// Header of the file that is being read
+	const IGzFileInfo& info() const {
+		if (!current) {
+			throw std::logic_error("All files were already read");
+		}
+		return current->info();
+	}
+
+	// Index of the file that is being read, equal to the number of files after the end
+	int fileIndex() const {
+		return current ? nextIndex - 1 - upcoming.valid() : std::ssize(openers);
+	}
+
+	int maxKeptBytes() const {
+		return current ? current->maxKeptBytes() : 0;
+	}
+};
+
+// Using IGzMultiFile as std::istream
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class BasicIGzMultiStream : private Detail::IGzStreamBuffer<Settings, IGzMultiFile<Settings>>, public std::istream
+{
+	using StreamBuffer = Detail::IGzStreamBuffer<Settings, IGzMultiFile<Settings>>;
+public:
+	// Open and read the files in the order they are given
+	BasicIGzMultiStream(const std::vector<std::string>& sourceFiles, int bytesToKeep = 10) : StreamBuffer(sourceFiles, bytesToKeep), std::istream(this) {}
+	BasicIGzMultiStream(std::initializer_list<std::string> sourceFiles, int bytesToKeep = 10)
+			: StreamBuffer(std::vector<std::string>(sourceFiles), bytesToKeep), std::istream(this) {}
+	// Use functions that fill a buffer of data and return how many bytes they wrote, one for each file
+	BasicIGzMultiStream(const std::vector<std::function<int(std::span<uint8_t> batch)>>& readMoreFunctions, int bytesToKeep = 10)
+			: StreamBuffer(readMoreFunctions, bytesToKeep), std::istream(this) {}
+
+	using StreamBuffer::info;
+
+	int fileIndex() const {
+		return StreamBuffer::file().fileIndex();
+	}
+};
+
+using IGzMultiStream = BasicIGzMultiStream<>;
+
+enum class CompressionFormat {
+	GZIP,
+	ZLIB,
+	DEFLATE,
+	NONE
+};
+
+namespace Detail {
+
+// Provides the contents of a whole file as contiguous memory, memory mapped if the platform allows it
+class MappedFile {
+	std::span<const uint8_t> contents = {};
+	std::vector<uint8_t> loaded = {};
+#ifdef EZGZ_HAS_MMAP
+	void* mapped = nullptr;
+#endif
+
+public:
+	MappedFile(const std::string& fileName) {
+#ifdef EZGZ_HAS_MMAP
+		int descriptor = open(fileName.c_str(), O_RDONLY);
+		if (descriptor < 0) {
+			throw std::runtime_error("Can't open file " + fileName);
+		}
+		struct stat status = {};
+		if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+			void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (mapping != MAP_FAILED) {
+				mapped = mapping;
+				contents = std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(mapping), status.st_size);
+			}
+		}
+		close(descriptor);
+		if (mapped) {
+			return;
+		}
+#endif
+		std::ifstream file(fileName, std::ios::binary);
+		if (!file.good()) {
+			throw std::runtime_error("Can't read file " + fileName);
+		}
+		loaded.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		contents = loaded;
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() {
+#ifdef EZGZ_HAS_MMAP
+		if (mapped)
+			munmap(mapped, contents.size());
+#endif
+	}
+
+	std::span<const uint8_t> data() const {
+		return contents;
+	}
+};
+
+// Raw deflate has no header, so it's recognised by decompressing the beginning of the data without errors
+// Random data often decodes as a short block, so the stream must end where the data does, except for a trailer of the given size
+inline bool startsWithDeflateStream(std::span<const uint8_t> start, bool isWhole, int trailerSize) {
+	const int64_t totalSize = start.size();
+	bool exhausted = false;
+	IDeflateArchive<MinDecompressionSettings> trial([&] (std::span<uint8_t> batch) {
+		int copying = std::min(batch.size(), start.size());
+		memcpy(batch.data(), start.data(), copying);
+		start = start.subspan(copying);
+		exhausted = exhausted || copying == 0;
+		return copying;
+	});
+	try {
+		while (trial.readSome()) {}
+		return isWhole && trial.compressedPosition() + trailerSize == totalSize;
+	} catch (std::runtime_error&) {
+		return exhausted && !isWhole; // The beginning was correct, what's missing wasn't examined
+	}
+}
+} // namespace Detail
+
+// Guesses the format from the beginning of the data, isWhole tells whether the data is not only the beginning
+inline CompressionFormat detectCompressionFormat(std::span<const uint8_t> start, bool isWhole) {
+	if (start.size() >= 2 && start[0] == 0x1f && start[1] == 0x8b) {
+		return CompressionFormat::GZIP;
+	}
+	if (start.size() >= 2 && IZlibFile<>::isZlibHeader(start[0], start[1]) && Detail::startsWithDeflateStream(start.subspan(2), isWhole, sizeof(uint32_t))) {
+		return CompressionFormat::ZLIB;
+	}
+	if (!start.empty() && Detail::startsWithDeflateStream(start, isWhole, 0)) {
+		return CompressionFormat::DEFLATE;
+	}
+	return CompressionFormat::NONE;
+}
+
+// Reads gzip files, zlib streams, raw deflate data or uncompressed data, the format is detected from the first bytes
+// Uncompressed data in memory or in a memory mapped file are returned without copying
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class IAutoFile : public Detail::BatchReading<IAutoFile<Settings>> {
+	constexpr static int examinedSize = 4096;
+	CompressionFormat detected = CompressionFormat::NONE;
+	std::variant<std::monostate, std::unique_ptr<IGzFile<Settings>>, std::unique_ptr<IZlibFile<Settings>>,
+			std::unique_ptr<IDeflateArchive<Settings>>> decompressor = {};
+	std::unique_ptr<Detail::MappedFile> mapped = {};
+
+	// Uncompressed data, either all in memory or read into a buffer
+	std::span<const uint8_t> plainData = {};
+	size_t plainPosition = 0;
+	std::function<int(std::span<uint8_t> batch)> readMore = {};
+	std::vector<char> plainBuffer = {};
+	int plainBuffered = 0;
+
+	void openData(std::span<const uint8_t> data) {
+		detected = detectCompressionFormat(data.first(std::min<size_t>(data.size(), examinedSize)), data.size() <= examinedSize);
+		if (detected == CompressionFormat::GZIP) {
+			decompressor = std::make_unique<IGzFile<Settings>>(data);
+		} else if (detected == CompressionFormat::ZLIB) {
+			decompressor = std::make_unique<IZlibFile<Settings>>(data);
+		} else if (detected == CompressionFormat::DEFLATE) {
+			decompressor = std::make_unique<IDeflateArchive<Settings>>(data);
+		} else {
+			plainData = data;
+		}
+	}
+
+	std::span<const char> readPlain(int bytesToKeep) {
+		if (!readMore) {
+			size_t start = plainPosition;
+			plainPosition = std::min<size_t>(plainData.size(), plainPosition + Settings::maxOutputBufferSize);
+			return std::span<const char>(reinterpret_cast<const char*>(plainData.data()) + start, plainPosition - start);
+		}
+		int keeping = std::min(bytesToKeep, plainBuffered);
+		memmove(plainBuffer.data(), plainBuffer.data() + plainBuffered - keeping, keeping);
+		int added = readMore(std::span<uint8_t>(reinterpret_cast<uint8_t*>(plainBuffer.data()) + keeping, plainBuffer.size() - keeping));
+		plainBuffered = keeping + added;
+		return std::span<const char>(plainBuffer.data() + keeping, added);
+	}
+
+public:
+	// Memory maps the file if possible
+	IAutoFile(const std::string& fileName) {
+#ifdef EZGZ_HAS_MMAP
+		mapped = std::make_unique<Detail::MappedFile>(fileName);
+		openData(mapped->data());
+#else
+		*this = IAutoFile([file = std::make_shared<std::ifstream>(fileName, std::ios::binary)] (std::span<uint8_t> batch) {
+			if (!file->is_open()) {
+				throw std::runtime_error("Can't read file");
+			}
+			file->read(reinterpret_cast<char*>(batch.data()), batch.size());
+			return int(file->gcount());
+		});
+#endif
+	}
+
+	IAutoFile(std::span<const uint8_t> data) {
+		openData(data);
+	}
+
+	// The function must return 0 only at the end of the data
+	IAutoFile(std::function<int(std::span<uint8_t> batch)> readMoreFunction) {
+		std::vector<uint8_t> start(examinedSize);
+		int examined = 0;
+		while (examined < examinedSize) {
+			int added = readMoreFunction(std::span<uint8_t>(start).subspan(examined));
+			if (added == 0)
+				break;
+			examined += added;
+		}
+		start.resize(examined);
+		detected = detectCompressionFormat(start, examined < examinedSize);
+
+		// The examined bytes are read again
+		auto withStart = [start = std::move(start), position = size_t(0), readMoreFunction] (std::span<uint8_t> batch) mutable {
+			if (position == start.size()) {
+				return readMoreFunction(batch);
+			}
+			int copying = std::min(batch.size(), start.size() - position);
+			memcpy(batch.data(), start.data() + position, copying);
+			position += copying;
+			return copying;
+		};
+		if (detected == CompressionFormat::GZIP) {
+			decompressor = std::make_unique<IGzFile<Settings>>(withStart);
+		} else if (detected == CompressionFormat::ZLIB) {
+			decompressor = std::make_unique<IZlibFile<Settings>>(withStart);
+		} else if (detected == CompressionFormat::DEFLATE) {
+			decompressor = std::make_unique<IDeflateArchive<Settings>>(withStart);
+		} else {
+			readMore = withStart;
+			plainBuffer.resize(Settings::maxOutputBufferSize);
+		}
+	}
+
+	CompressionFormat format() const {
+		return detected;
+	}
+
+	// Available only if it's a gzip file
+	const IGzFileInfo* gzipInfo() const {
+		if (const std::unique_ptr<IGzFile<Settings>>* file = std::get_if<std::unique_ptr<IGzFile<Settings>>>(&decompressor)) {
+			return &(*file)->info();
+		}
+		return nullptr;
+	}
+
+	// Returns the next batch, bytesToKeep bytes before it are kept from the previous batch
+	std::optional<std::span<const char>> readSome(int bytesToKeep = 0) {
+		if (std::holds_alternative<std::monostate>(decompressor)) {
+			std::span<const char> batch = readPlain(bytesToKeep);
+			if (batch.empty()) {
+				return std::nullopt;
+			}
+			return batch;
+		}
+		return std::visit([bytesToKeep] (auto& file) -> std::optional<std::span<const char>> {
+			if constexpr (std::is_same_v<std::decay_t<decltype(file)>, std::monostate>) {
+				return std::nullopt;
+			} else {
+				return file->readSome(bytesToKeep);
+			}
+		}, decompressor);
+	}
+
+	int maxKeptBytes() const {
+		if (std::holds_alternative<std::monostate>(decompressor)) {
+			return readMore ? Settings::maxOutputBufferSize / 2 : std::numeric_limits<int>::max();
+		}
+		return std::visit([] (auto& file) -> int {
+			if constexpr (std::is_same_v<std::decay_t<decltype(file)>, std::monostate>) {
+				return 0;
+			} else {
+				return file->maxKeptBytes();
+			}
+		}, decompressor);
+	}
+};
+
+// Using IAutoFile as std::istream, accepts the same sources as BasicIGzStream
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class BasicIAutoStream : private Detail::IGzStreamBuffer<Settings, IAutoFile<Settings>>, public std::istream
+{
+	using StreamBuffer = Detail::IGzStreamBuffer<Settings, IAutoFile<Settings>>;
+public:
+	BasicIAutoStream(const std::string& sourceFile, int bytesToKeep = 10) : StreamBuffer(sourceFile, bytesToKeep), std::istream(this) {}
+	BasicIAutoStream(std::span<const uint8_t> data, int bytesToKeep = 10) : StreamBuffer(data, bytesToKeep), std::istream(this) {}
+	BasicIAutoStream(std::function<int(std::span<uint8_t> batch)> readMoreFunction, int bytesToKeep = 10)
+			: StreamBuffer(readMoreFunction, bytesToKeep), std::istream(this) {}
+	BasicIAutoStream(std::istream& input, int bytesToKeep = 10) : StreamBuffer(std::function<int(std::span<uint8_t>)>([&input] (std::span<uint8_t> batch) -> int {
+		input.read(reinterpret_cast<char*>(batch.data()), batch.size());
+		return input.gcount();
+	}), bytesToKeep), std::istream(this) {}
+
+	CompressionFormat format() const {
+		return StreamBuffer::file().format();
+	}
+};
+
+using IAutoStream = BasicIAutoStream<>;
+
+enum class TarEntryType {
+	FILE,
+	DIRECTORY,
+	SYMLINK,
+	HARDLINK,
+	OTHER
+};
+
+// Information about a file in a .tar archive, long names from pax or GNU headers are already applied
+struct ITarEntryInfo {
+	std::string name;
+	std::string linkName;
+	TarEntryType type = TarEntryType::OTHER;
+	int64_t size = 0;
+	int64_t modificationTime = 0;
+	uint32_t mode = 0;
+};
+
+// Parses a .tar.gz archive while decompressing it, the contents of entries are returned directly from the decompression buffer
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class ITarGzFile {
+	IGzFile<Settings> file;
+	std::span<const char> pending = {}; // Decompressed, but not processed yet, always the end of the last batch
+	int64_t entryLeft = 0;
+	int64_t paddingLeft = 0;
+	bool finished = false;
+
+	static constexpr int blockSize = 512;
+
+	// Returns false if the archive ends before the given number of bytes is available
+	bool fill(int bytes) {
+		while (std::ssize(pending) < bytes) {
+			// The batch is preceded by the kept bytes, so the unprocessed part is contiguous with the new data
+			std::optional<std::span<const char>> batch = file.readSome(pending.size());
+			if (!batch.has_value()) {
+				return false;
+			}
+			pending = std::span<const char>(batch->data() - pending.size(), pending.size() + batch->size());
+		}
+		return true;
+	}
+
+	void skip(int64_t bytes) {
+		while (bytes > 0) {
+			if (pending.empty() && !fill(1)) {
+				throw std::runtime_error("Tar archive is truncated");
+			}
+			int64_t skipping = std::min<int64_t>(bytes, pending.size());
+			pending = pending.subspan(skipping);
+			bytes -= skipping;
+		}
+	}
+
+	std::string readWhole(int64_t bytes) {
+		std::string result;
+		while (std::ssize(result) < bytes) {
+			if (pending.empty() && !fill(1)) {
+				throw std::runtime_error("Tar archive is truncated");
+			}
+			int64_t taking = std::min<int64_t>(bytes - result.size(), pending.size());
+			result.append(pending.data(), taking);
+			pending = pending.subspan(taking);
+		}
+		skip((blockSize - bytes % blockSize) % blockSize);
+		return result;
+	}
+
+	static std::string_view textField(std::span<const char> header, int offset, int size) {
+		std::string_view field(header.data() + offset, size);
+		return field.substr(0, field.find('\0'));
+	}
+
+	static int64_t numericField(std::span<const char> header, int offset, int size) {
+		std::span<const char> field = header.subspan(offset, size);
+		int64_t result = 0;
+		if (uint8_t(field[0]) & 0x80) {
+			// Base-256 encoding used by GNU tar for values that don't fit
+			result = uint8_t(field[0]) & 0x3f;
+			for (int i = 1; i < size; i++) {
+				if (result > (std::numeric_limits<int64_t>::max() >> 8)) {
+					throw std::runtime_error("Tar archive's numeric field is too large");
+				}
+				result = (result << 8) | uint8_t(field[i]);
+			}
+			return result;
+		}
+		for (char letter : field) {
+			if (letter >= '0' && letter <= '7') {
+				result = (result << 3) | (letter - '0');
+			} else if (letter != ' ' || result != 0) {
+				break; // Leading spaces are allowed, trailing spaces or zeroes end it
+			}
+		}
+		return result;
+	}
+
+	// Contents are padded to whole blocks, the size must leave room for it
+	static int64_t validSize(int64_t size) {
+		if (size < 0 || size > std::numeric_limits<int64_t>::max() - blockSize) {
+			throw std::runtime_error("Tar archive's entry size is out of range");
+		}
+		return size;
+	}
+
+	// Applies the records in the format "%d %s=%s\n" from a pax extended header
+	static void applyPaxRecords(std::string_view records, ITarEntryInfo& entry, std::optional<int64_t>& size) {
+		while (!records.empty()) {
+			size_t lengthEnd = records.find(' ');
+			if (lengthEnd == std::string_view::npos) {
+				throw std::runtime_error("Tar archive's pax header is corrupted");
+			}
+			int length = 0;
+			std::from_chars(records.data(), records.data() + lengthEnd, length);
+			if (length < int(lengthEnd) + 2 || length > std::ssize(records)) { // At least the space and the newline
+				throw std::runtime_error("Tar archive's pax header is corrupted");
+			}
+			std::string_view record = records.substr(lengthEnd + 1, length - lengthEnd - 2); // Without the newline
+			records = records.substr(length);
+			size_t separator = record.find('=');
+			if (separator == std::string_view::npos) {
+				throw std::runtime_error("Tar archive's pax header is corrupted");
+			}
+			std::string_view key = record.substr(0, separator);
+			std::string_view value = record.substr(separator + 1);
+			if (key == "path") {
+				entry.name = value;
+			} else if (key == "linkpath") {
+				entry.linkName = value;
+			} else if (key == "size") {
+				int64_t parsed = -1;
+				auto [parsedEnd, error] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+				if (error != std::errc() || parsedEnd != value.data() + value.size() || parsed < 0) {
+					throw std::runtime_error("Tar archive's pax header is corrupted");
+				}
+				size = parsed;
+			} else if (key == "mtime") {
+				std::from_chars(value.data(), value.data() + value.size(), entry.modificationTime);
+			}
+		}
+	}
+
+public:
+	ITarGzFile(std::function<int(std::span<uint8_t> batch)> readMoreFunction) : file(readMoreFunction) {}
+	ITarGzFile(const std::string& fileName) : file(fileName) {}
+	ITarGzFile(std::span<const uint8_t> data) : file(data) {}
+
+	// Skips the rest of the current entry and parses the header of the next one, returns nullopt at the end of the archive
+	std::optional<ITarEntryInfo> nextEntry() {
+		skip(entryLeft + paddingLeft);
+		entryLeft = 0;
+		paddingLeft = 0;
+
+		ITarEntryInfo overrides = {}; // From headers preceding the actual header
+		std::optional<int64_t> overridenSize = {};
+		while (!finished) {
+			if (!fill(blockSize)) {
+				if (!pending.empty()) {
+					throw std::runtime_error("Tar archive is truncated");
+				}
+				finished = true; // Some archivers omit the terminating empty blocks
+				break;
+			}
+			std::span<const char> header = pending.first(blockSize);
+			pending = pending.subspan(blockSize);
+
+			int checksum = 0;
+			for (int i = 0; i < blockSize; i++) {
+				checksum += (i >= 148 && i < 156) ? ' ' : uint8_t(header[i]);
+			}
+			if (checksum == ' ' * 8) { // Only zeroes
+				finished = true;
+				break;
+			}
+			if (checksum != numericField(header, 148, 8)) {
+				throw std::runtime_error("Tar archive's header checksum doesn't match the header");
+			}
+
+			int64_t size = validSize(numericField(header, 124, 12));
+			char typeFlag = header[156];
+			if (typeFlag == 'x') {
+				applyPaxRecords(readWhole(size), overrides, overridenSize);
+				continue;
+			} else if (typeFlag == 'L' || typeFlag == 'K') {
+				std::string longName = readWhole(size);
+				(typeFlag == 'L' ? overrides.name : overrides.linkName) = longName.substr(0, longName.find('\0'));
+				continue;
+			} else if (typeFlag == 'g') {
+				skip(size + (blockSize - size % blockSize) % blockSize); // Global pax header, nothing useful there
+				continue;
+			}
+
+			ITarEntryInfo entry = {};
+			entry.name = textField(header, 0, 100);
+			if (std::string_view(header.data() + 257, 6) == std::string_view("ustar\0", 6)) { // GNU's "ustar  " has other fields there
+				std::string_view prefix = textField(header, 345, 155);
+				if (!prefix.empty()) {
+					entry.name = std::string(prefix) + '/' + entry.name;
+				}
+			}
+			entry.linkName = textField(header, 157, 100);
+			entry.mode = numericField(header, 100, 8);
+			entry.modificationTime = numericField(header, 136, 12);
+			if (typeFlag == '0' || typeFlag == '\0' || typeFlag == '7') {
+				entry.type = TarEntryType::FILE;
+			} else if (typeFlag == '5') {
+				entry.type = TarEntryType::DIRECTORY;
+			} else if (typeFlag == '2') {
+				entry.type = TarEntryType::SYMLINK;
+			} else if (typeFlag == '1') {
+				entry.type = TarEntryType::HARDLINK;
+			}
+			if (!overrides.name.empty()) {
+				entry.name = overrides.name;
+			}
+			if (!overrides.linkName.empty()) {
+				entry.linkName = overrides.linkName;
+			}
+			if (overrides.modificationTime != 0) {
+				entry.modificationTime = overrides.modificationTime;
+			}
+			entry.size = validSize(overridenSize.value_or(size));
+
+			// Links and directories may declare a size, but they have no contents
+			int64_t storedSize = (entry.type == TarEntryType::HARDLINK || entry.type == TarEntryType::SYMLINK
+					|| entry.type == TarEntryType::DIRECTORY) ? 0 : entry.size;
+			entryLeft = storedSize;
+			paddingLeft = (blockSize - storedSize % blockSize) % blockSize;
+			return entry;
+		}
+		return std::nullopt;
+	}
+
+	// Returns the next part of the current entry's contents, valid until the next call, nullopt after the entry was read whole
+	std::optional<std::span<const char>> readSome() {
+		if (entryLeft == 0) {
+			return std::nullopt;
+		}
+		if (pending.empty() && !fill(1)) {
+			throw std::runtime_error("Tar archive is truncated");
+		}
+		int64_t taking = std::min<int64_t>(entryLeft, pending.size());
+		std::span<const char> returning = pending.first(taking);
+		pending = pending.subspan(taking);
+		entryLeft -= taking;
+		return returning;
+	}
+
+	void readEntry(const std::function<void(std::span<const char>)>& reader) {
+		while (std::optional<std::span<const char>> chunk = readSome()) {
+			reader(*chunk);
+		}
+	}
+
+	std::vector<char> readEntry() {
+		std::vector<char> returned;
+		returned.reserve(std::min<int64_t>(entryLeft, 1 << 24)); // The declared size may be a lie
+		while (std::optional<std::span<const char>> chunk = readSome()) {
+			returned.insert(returned.end(), chunk->begin(), chunk->end());
+		}
+		return returned;
+	}
+
+	const IGzFileInfo& info() const {
+		return file.info();
+	}
+};
+
+enum class ZipCompressionMethod {
+	STORED,
+	DEFLATED,
+	OTHER
+};
+
+// Information about a file in a .zip archive, as declared in its central directory
+struct IZipEntryInfo {
+	std::string name;
+	std::string comment;
+	ZipCompressionMethod compressionMethod = ZipCompressionMethod::OTHER;
+	bool encrypted = false;
+	uint16_t modificationTime = 0; // In MS-DOS format
+	uint16_t modificationDate = 0; // In MS-DOS format
+	uint32_t crc32 = 0;
+	int64_t compressedSize = 0;
+	int64_t uncompressedSize = 0;
+	int64_t localHeaderOffset = 0;
+	std::span<const uint8_t> compressedData = {}; // Points into the archive's memory
+
+	bool isDirectory() const {
+		return !name.empty() && name.back() == '/';
+	}
+};
+
+// Decompressed contents of an entry in a .zip archive, points directly into the archive if the entry isn't compressed
+class IZipEntryContents {
+	std::vector<char> inflated = {};
+	std::span<const char> contents = {};
+
+public:
+	IZipEntryContents(std::span<const char> stored) : contents(stored) {}
+	IZipEntryContents(std::vector<char>&& inflatedData) : inflated(std::move(inflatedData)), contents(inflated) {}
+	IZipEntryContents(IZipEntryContents&& other) noexcept = default; // Moving a vector keeps its data in place
+	IZipEntryContents(const IZipEntryContents&) = delete;
+	IZipEntryContents& operator=(const IZipEntryContents&) = delete;
+
+	std::span<const char> data() const {
+		return contents;
+	}
+
+	operator std::span<const char>() const {
+		return contents;
+	}
+
+	// True if the contents refer to the archive's memory rather than to a separately decompressed copy
+	bool isZeroCopy() const {
+		return inflated.empty() && !contents.empty();
+	}
+};
+
+// Parses a .zip archive held in memory (or memory mapped) and decompresses its entries, together or individually
+template <DecompressionSettings Settings = DefaultDecompressionSettings>
+class IZipArchive {
+	std::shared_ptr<Detail::MappedFile> file = {};
+	std::span<const uint8_t> archive = {};
+	std::vector<IZipEntryInfo> parsedEntries = {};
+
+	static constexpr uint32_t endOfCentralDirectorySignature = 0x06054b50;
+	static constexpr uint32_t zip64EndOfCentralDirectorySignature = 0x06064b50;
+	static constexpr uint32_t zip64LocatorSignature = 0x07064b50;
+	static constexpr uint32_t centralDirectorySignature = 0x02014b50;
+	static constexpr uint32_t localHeaderSignature = 0x04034b50;
+
+	// Zip64 values are unsigned, but those that wouldn't fit into a signed number can't be valid
+	int64_t readZip64Value(int64_t position) const {
+		uint64_t value = Detail::readLittleEndian<uint64_t>(archive, position);
+		if (value > uint64_t(std::numeric_limits<int64_t>::max())) [[unlikely]] {
+			throw std::runtime_error("Zip64 archive contains an impossibly large value");
+		}
+		return value;
+	}
+
+	void parseCentralDirectory() {
+		using Detail::readLittleEndian;
+		constexpr int endOfCentralDirectorySize = 22;
+		constexpr int centralDirectoryEntrySize = 46;
+		if (std::ssize(archive) < endOfCentralDirectorySize) {
+			throw std::runtime_error("Trying to parse something that isn't a Zip archive");
+		}
+
+		// The end record is followed only by a comment of up to 65535 bytes
+		int64_t endPosition = std::ssize(archive) - endOfCentralDirectorySize;
+		const int64_t lowestPosition = std::max<int64_t>(0, endPosition - 0xffff);
+		while (readLittleEndian<uint32_t>(archive, endPosition) != endOfCentralDirectorySignature) {
+			if (endPosition == lowestPosition) {
+				throw std::runtime_error("Trying to parse something that isn't a Zip archive");
+			}
+			endPosition--;
+		}
+
+		int64_t entryCount = readLittleEndian<uint16_t>(archive, endPosition + 10);
+		int64_t directorySize = readLittleEndian<uint32_t>(archive, endPosition + 12);
+		int64_t directoryOffset = readLittleEndian<uint32_t>(archive, endPosition + 16);
+		if (entryCount == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+			// Zip64 archive, the true values are in another record referred to by a locator placed right before the end record
+			int64_t locatorPosition = endPosition - 20;
+			if (locatorPosition < 0 || readLittleEndian<uint32_t>(archive, locatorPosition) != zip64LocatorSignature) {
+				throw std::runtime_error("Zip64 end of central directory locator is missing");
+			}
+			int64_t zip64EndPosition = readZip64Value(locatorPosition + 8);
+			if (readLittleEndian<uint32_t>(archive, zip64EndPosition) != zip64EndOfCentralDirectorySignature) {
+				throw std::runtime_error("Zip64 end of central directory record is corrupted");
+			}
+			entryCount = readZip64Value(zip64EndPosition + 32);
+			directorySize = readZip64Value(zip64EndPosition + 40);
+			directoryOffset = readZip64Value(zip64EndPosition + 48);
+		}
+		if (directoryOffset > std::ssize(archive) || directorySize > std::ssize(archive) - directoryOffset) {
+			throw std::runtime_error("Zip archive's central directory is out of bounds");
+		}
+
+		parsedEntries.reserve(std::min(entryCount, directorySize / centralDirectoryEntrySize)); // The count alone can't be trusted
+		int64_t position = directoryOffset;
+		for (int64_t i = 0; i < entryCount; i++) {
+			if (readLittleEndian<uint32_t>(archive, position) != centralDirectorySignature) {
+				throw std::runtime_error("Zip archive's central directory is corrupted");
+			}
+			IZipEntryInfo& entry = parsedEntries.emplace_back();
+			entry.encrypted = readLittleEndian<uint16_t>(archive, position + 8) & 0x01;
+			uint16_t method = readLittleEndian<uint16_t>(archive, position + 10);
+			if (method == 0) {
+				entry.compressionMethod = ZipCompressionMethod::STORED;
+			} else if (method == 8) {
+				entry.compressionMethod = ZipCompressionMethod::DEFLATED;
+			}
+			entry.modificationTime = readLittleEndian<uint16_t>(archive, position + 12);
+			entry.modificationDate = readLittleEndian<uint16_t>(archive, position + 14);
+			entry.crc32 = readLittleEndian<uint32_t>(archive, position + 16);
+			entry.compressedSize = readLittleEndian<uint32_t>(archive, position + 20);
+			entry.uncompressedSize = readLittleEndian<uint32_t>(archive, position + 24);
+			int nameLength = readLittleEndian<uint16_t>(archive, position + 28);
+			int extraLength = readLittleEndian<uint16_t>(archive, position + 30);
+			int commentLength = readLittleEndian<uint16_t>(archive, position + 32);
+			entry.localHeaderOffset = readLittleEndian<uint32_t>(archive, position + 42);
+			position += centralDirectoryEntrySize;
+			if (position + nameLength + extraLength + commentLength > std::ssize(archive)) {
+				throw std::runtime_error("Zip archive's central directory is truncated");
+			}
+			entry.name = std::string(reinterpret_cast<const char*>(&archive[position]), nameLength);
+			position += nameLength;
+
+			// Sizes that don't fit into 32 bits are in the Zip64 extra field, in fixed order, present only if overflowing
+			for (int64_t extraPosition = position; extraPosition + 4 <= position + extraLength; ) {
+				uint16_t fieldType = readLittleEndian<uint16_t>(archive, extraPosition);
+				uint16_t fieldSize = readLittleEndian<uint16_t>(archive, extraPosition + 2);
+				if (fieldType == 0x0001) {
+					int64_t fieldPosition = extraPosition + 4;
+					for (int64_t* value : {&entry.uncompressedSize, &entry.compressedSize, &entry.localHeaderOffset}) {
+						if (*value == 0xffffffff) {
+							*value = readZip64Value(fieldPosition);
+							fieldPosition += sizeof(uint64_t);
+						}
+					}
+				}
+				extraPosition += 4 + fieldSize;
+			}
+			position += extraLength;
+			entry.comment = std::string(reinterpret_cast<const char*>(&archive[position]), commentLength);
+			position += commentLength;
+
+			// The local header may have a different extra field than the central directory
+			if (readLittleEndian<uint32_t>(archive, entry.localHeaderOffset) != localHeaderSignature) {
+				throw std::runtime_error("Zip archive's local header of " + entry.name + " is corrupted");
+			}
+			int64_t dataStart = entry.localHeaderOffset + 30 + readLittleEndian<uint16_t>(archive, entry.localHeaderOffset + 26)
+					+ readLittleEndian<uint16_t>(archive, entry.localHeaderOffset + 28);
+			if (entry.compressedSize > std::ssize(archive) - dataStart) {
+				throw std::runtime_error("Zip archive's entry " + entry.name + " is out of bounds");
+			}
+			entry.compressedData = archive.subspan(dataStart, entry.compressedSize);
+		}
+	}
+
+	static void verify(const IZipEntryInfo& entry, std::span<const char> contents, typename Settings::Checksum& checksum) {
+		if (std::ssize(contents) != entry.uncompressedSize) {
+			throw std::runtime_error("Zip archive's entry " + entry.name + " has a different size than declared");
+		}
+		if constexpr(Settings::verifyChecksum) {
+			if (uint32_t(checksum()) != entry.crc32)
+				throw std::runtime_error("Zip archive's entry " + entry.name + " has a mismatching crc32 checksum");
+		}
+	}
+
+	static std::vector<char> inflate(const IZipEntryInfo& entry) {
+		constexpr int64_t maxDeflateRatio = 1032;
+		std::vector<char> result;
+		result.reserve(std::min(entry.uncompressedSize, int64_t(entry.compressedData.size()) * maxDeflateRatio)); // The declared size may be a lie
+		Detail::ByteInput<Settings> input(Detail::readFromSpan(entry.compressedData));
+		Detail::ByteOutput<Settings> output;
+		Detail::DeflateReader reader(input, output);
+		bool workToDo = false;
+		do {
+			workToDo = reader.parseSome();
+			std::span<const char> batch = output.consume();
+			result.insert(result.end(), batch.begin(), batch.end());
+		} while (workToDo || output.hasUnconsumed());
+		verify(entry, result, output.getChecksum());
+		return result;
+	}
+
+public:
+	// Maps the file into memory and parses its central directory
+	IZipArchive(const std::string& fileName) : file(std::make_shared<Detail::MappedFile>(fileName)), archive(file->data()) {
+		parseCentralDirectory();
+	}
+
+	// Parses the archive from memory that must stay valid as long as this object or the returned contents are used
+	IZipArchive(std::span<const uint8_t> data) : archive(data) {
+		parseCentralDirectory();
+	}
+
+	const std::vector<IZipEntryInfo>& entries() const {
+		return parsedEntries;
+	}
+
+	// Returns nullptr if there's no such entry
+	const IZipEntryInfo* find(std::string_view name) const {
+		for (const IZipEntryInfo& entry : parsedEntries) {
+			if (entry.name == name)
+				return &entry;
+		}
+		return nullptr;
+	}
+
+	// Can be safely called from multiple threads at once
+	IZipEntryContents read(const IZipEntryInfo& entry) const {
+		if (entry.encrypted) {
+			throw std::runtime_error("Zip archive's entry " + entry.name + " is encrypted");
+		}
+		if (entry.compressionMethod == ZipCompressionMethod::STORED) {
+			std::span<const char> contents(reinterpret_cast<const char*>(entry.compressedData.data()), entry.compressedData.size());
+			typename Settings::Checksum checksum = {};
+			if constexpr(Settings::verifyChecksum) {
+				checksum(entry.compressedData);
+			}
+			verify(entry, contents, checksum);
+			return IZipEntryContents(contents);
+		} else if (entry.compressionMethod == ZipCompressionMethod::DEFLATED) {
+			return IZipEntryContents(inflate(entry));
+		}
+		throw std::runtime_error("Zip archive's entry " + entry.name + " uses an unsupported compression method");
+	}
+
+	void readAll(const std::function<void(const IZipEntryInfo&, std::span<const char>)>& reader) const {
+		for (const IZipEntryInfo& entry : parsedEntries) {
+			reader(entry, read(entry));
+		}
+	}
+
+	// The reader is called from multiple threads at once, in no particular order; the first exception thrown is propagated
+	void readAllParallel(const std::function<void(const IZipEntryInfo&, std::span<const char>)>& reader,
+			int threadCount = std::thread::hardware_concurrency()) const {
+		std::atomic<size_t> nextEntry = 0;
+		std::exception_ptr failure = nullptr;
+		std::mutex failureLock;
+		auto work = [&] () {
+			for (size_t index = nextEntry++; index < parsedEntries.size(); index = nextEntry++) {
+				try {
+					reader(parsedEntries[index], read(parsedEntries[index]));
+				} catch (...) {
+					std::lock_guard lock(failureLock);
+					if (!failure)
+						failure = std::current_exception();
+					nextEntry = parsedEntries.size();
+				}
+			}
+		};
+		{
+			std::vector<std::jthread> helpers;
+			for (int i = 1; i < threadCount; i++) {
+				helpers.emplace_back(work);
+			}
+			work();
+		}
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
+	}
+};
+
+namespace Detail {
+
+// Writes data by bits, lowest bit first, as deflate requires
+class BitWriter {
+	std::vector<uint8_t> written = {};
+	uint64_t pendingBits = 0;
+	int pendingCount = 0; // Always less than 32 after a call returns
+
+public:
+	// Up to 32 bits, unwanted bits must be blanked
+	void putBits(uint32_t bits, int amount) {
+		pendingBits |= uint64_t(bits) << pendingCount;
+		pendingCount += amount;
+		if (pendingCount >= 32) {
+			size_t size = written.size();
+			written.resize(size + 4);
+			if constexpr (std::endian::native == std::endian::little) {
+				uint32_t lowerBits = uint32_t(pendingBits);
+				memcpy(&written[size], &lowerBits, sizeof(lowerBits));
+			} else {
+				for (int i = 0; i < 4; i++) {
+					written[size + i] = uint8_t(pendingBits >> (i * 8));
+				}
+			}
+			pendingBits >>= 32;
+			pendingCount -= 32;
+		}
+	}
+
+	// Pads the last byte with zeroes
+	void alignToByte() {
+		while (pendingCount > 0) {
+			written.push_back(uint8_t(pendingBits));
+			pendingBits >>= 8;
+			pendingCount = std::max(pendingCount - 8, 0);
+		}
+		pendingBits = 0;
+	}
+
+	void putAlignedBytes(std::span<const uint8_t> bytes) {
+		alignToByte();
+		written.insert(written.end(), bytes.begin(), bytes.end());
+	}
+
+	int64_t bitsWritten() const {
+		return int64_t(written.size()) * 8 + pendingCount;
+	}
+
+	// Continues with everything written into the other writer, which doesn't have to end at the same bit position
+	void putWritten(const BitWriter& other) {
+		if (pendingCount == 0) {
+			written.insert(written.end(), other.written.begin(), other.written.end());
+		} else {
+			size_t position = 0;
+			for ( ; position + 4 <= other.written.size(); position += 4) {
+				putBits(other.written[position] | (other.written[position + 1] << 8) | (other.written[position + 2] << 16)
+						| (uint32_t(other.written[position + 3]) << 24), 32);
+			}
+			for ( ; position < other.written.size(); position++) {
+				putBits(other.written[position], 8);
+			}
+		}
+		putBits(uint32_t(other.pendingBits), other.pendingCount);
+	}
+
+	// Returns all bytes whose all bits are already known and removes them from the writer
+	std::vector<uint8_t> takeCompleteBytes() {
+		while (pendingCount >= 8) {
+			written.push_back(uint8_t(pendingBits));
+			pendingBits >>= 8;
+			pendingCount -= 8;
+		}
+		std::vector<uint8_t> returning;
+		std::swap(returning, written);
+		return returning;
+	}
+};
+
+constexpr int endOfBlockSymbol = 256;
+constexpr int maxLiteralCodes = 286;
+constexpr int maxDistanceCodes = 30;
+constexpr std::array<uint16_t, 29> lengthBases = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99,
+		115, 131, 163, 195, 227, 258};
+constexpr std::array<uint8_t, 29> lengthExtraBits = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<uint16_t, 30> distanceBases = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+		1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr std::array<uint8_t, 30> distanceExtraBits = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+		12, 12, 13, 13};
+
+// Index is the length of a repetition, value is the index of its code in lengthBases
+constexpr std::array<uint8_t, 259> lengthCodeLookup = [] {
+	std::array<uint8_t, 259> result = {};
+	for (int code = 0; code < std::ssize(lengthBases); code++) {
+		for (int length = lengthBases[code]; length < lengthBases[code] + (1 << lengthExtraBits[code]) && length <= 258; length++) {
+			result[length] = code;
+		}
+	}
+	result[258] = 28; // 227 + 31 would be also 258, but has a shorter code
+	return result;
+}();
+
+// Distances up to 256 are indexed by distance - 1, longer ones by 256 + ((distance - 1) >> 7)
+constexpr std::array<uint8_t, 512> distanceCodeLookup = [] {
+	std::array<uint8_t, 512> result = {};
+	for (int code = 0; code < std::ssize(distanceBases); code++) {
+		for (int distance = distanceBases[code]; distance < distanceBases[code] + (1 << distanceExtraBits[code]); distance++) {
+			if (distance <= 256) {
+				result[distance - 1] = code;
+			} else {
+				result[256 + ((distance - 1) >> 7)] = code;
+			}
+		}
+	}
+	return result;
+}();
+
+inline int lengthCode(int length) {
+	return lengthCodeLookup[length];
+}
+
+inline int distanceCode(int distance) {
+	return (distance <= 256) ? distanceCodeLookup[distance - 1] : distanceCodeLookup[256 + ((distance - 1) >> 7)];
+}
+
+// Computes lengths of Huffman codes that are optimal for the given frequencies, limited to a maximum length
+inline void buildCodeLengths(std::span<const uint32_t> frequencies, std::span<uint8_t> lengths, int maxLength) {
+	std::fill(lengths.begin(), lengths.end(), 0);
+	std::vector<int> symbols;
+	for (int i = 0; i < std::ssize(frequencies); i++) {
+		if (frequencies[i] > 0)
+			symbols.push_back(i);
+	}
+	if (symbols.size() < 2) {
+		// A single code would be incomplete, some decoders don't like it, so others are made up
+		lengths[symbols.empty() || symbols.front() != 0 ? 0 : 1] = 1;
+		lengths[symbols.empty() ? 1 : symbols.front()] = 1;
+		return;
+	}
+	std::stable_sort(symbols.begin(), symbols.end(), [&] (int first, int second) {
+		return frequencies[first] < frequencies[second];
+	});
+
+	// Two queue construction of the Huffman tree, leaves are sorted, internal nodes are created in ascending order of weight
+	const int leafCount = symbols.size();
+	std::vector<uint64_t> weights(leafCount * 2 - 1);
+	std::vector<int> parents(leafCount * 2 - 1);
+	for (int i = 0; i < leafCount; i++) {
+		weights[i] = frequencies[symbols[i]];
+	}
+	int nextLeaf = 0;
+	int nextInternal = leafCount;
+	for (int created = leafCount; created < std::ssize(weights); created++) {
+		auto takeLightest = [&] () {
+			if (nextLeaf < leafCount && (nextInternal >= created || weights[nextLeaf] <= weights[nextInternal])) {
+				return nextLeaf++;
+			}
+			return nextInternal++;
+		};
+		int first = takeLightest();
+		int second = takeLightest();
+		weights[created] = weights[first] + weights[second];
+		parents[first] = created;
+		parents[second] = created;
+	}
+
+	// Depths are computed from the root, which is the last node
+	std::vector<int> depths(weights.size());
+	for (int i = std::ssize(weights) - 2; i >= 0; i--) {
+		depths[i] = depths[parents[i]] + 1;
+	}
+	std::array<int, 64> lengthCounts = {};
+	for (int i = 0; i < leafCount; i++) {
+		lengthCounts[std::min(depths[i], maxLength)]++;
+	}
+
+	// Clamping made the codes overflow, move leaves deeper until the code is exactly complete (the approach used by miniz)
+	int64_t kraftTotal = 0;
+	for (int length = 1; length <= maxLength; length++) {
+		kraftTotal += int64_t(lengthCounts[length]) << (maxLength - length);
+	}
+	while (kraftTotal > (int64_t(1) << maxLength)) {
+		lengthCounts[maxLength]--;
+		for (int length = maxLength - 1; length > 0; length--) {
+			if (lengthCounts[length] > 0) {
+				lengthCounts[length]--;
+				lengthCounts[length + 1] += 2;
+				break;
+			}
+		}
+		kraftTotal--;
+	}
+
+	// The least frequent symbols get the longest codes
+	int symbolIndex = 0;
+	for (int length = maxLength; length > 0; length--) {
+		for (int i = 0; i < lengthCounts[length]; i++) {
+			lengths[symbols[symbolIndex]] = length;
+			symbolIndex++;
+		}
+	}
+}
+
+// Computes the canonical Huffman codes from their lengths, bit reversed so that they can be written lowest bit first
+inline void buildCodes(std::span<const uint8_t> lengths, std::span<uint16_t> codes) {
+	std::array<int, 17> lengthCounts = {};
+	for (uint8_t length : lengths) {
+		lengthCounts[length]++;
+	}
+	lengthCounts[0] = 0;
+	std::array<int, 17> nextCodes = {};
+	int code = 0;
+	for (int length = 1; length <= 16; length++) {
+		code = (code + lengthCounts[length - 1]) << 1;
+		nextCodes[length] = code;
+	}
+	for (int i = 0; i < std::ssize(lengths); i++) {
+		if (lengths[i] == 0)
+			continue;
+		int forward = nextCodes[lengths[i]]++;
+		int reversed = 0;
+		for (int bit = 0; bit < lengths[i]; bit++) {
+			reversed = (reversed << 1) | ((forward >> bit) & 1);
+		}
+		codes[i] = reversed;
+	}
+}
+
+// Huffman codes for a deflate block, with lengths used to compute the block's size
+struct DeflateCodes {
+	std::array<uint8_t, 288> literalLengths = {};
+	std::array<uint16_t, 288> literalCodes = {};
+	std::array<uint8_t, 32> distanceLengths = {};
+	std::array<uint16_t, 32> distanceCodes = {};
+
+	static const DeflateCodes& fixed() {
+		static const DeflateCodes codes = [] {
+			DeflateCodes made;
+			for (int i = 0; i < std::ssize(made.literalLengths); i++) {
+				made.literalLengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+			}
+			std::fill(made.distanceLengths.begin(), made.distanceLengths.end(), 5);
+			buildCodes(made.literalLengths, made.literalCodes);
+			buildCodes(made.distanceLengths, made.distanceCodes);
+			return made;
+		}();
+		return codes;
+	}
+};
+
+// Symbol frequencies of a sequence of tokens
+struct DeflateStatistics {
+	std::array<uint32_t, maxLiteralCodes> literals = {};
+	std::array<uint32_t, maxDistanceCodes> distances = {};
+	int64_t extraBits = 0;
+
+	void add(DeflateToken token) {
+		if (token.distance == 0) {
+			literals[token.lengthOrLiteral]++;
+		} else {
+			int lengthIndex = lengthCode(token.lengthOrLiteral);
+			literals[257 + lengthIndex]++;
+			int distanceIndex = distanceCode(token.distance);
+			distances[distanceIndex]++;
+			extraBits += lengthExtraBits[lengthIndex] + distanceExtraBits[distanceIndex];
+		}
+	}
+
+	DeflateStatistics(std::span<const DeflateToken> tokens) {
+		for (DeflateToken token : tokens) {
+			add(token);
+		}
+		literals[endOfBlockSymbol] = 1;
+	}
+
+	int64_t bitsWith(const DeflateCodes& codes) const {
+		int64_t bits = extraBits;
+		for (int i = 0; i < std::ssize(literals); i++) {
+			bits += int64_t(literals[i]) * codes.literalLengths[i];
+		}
+		for (int i = 0; i < std::ssize(distances); i++) {
+			bits += int64_t(distances[i]) * codes.distanceLengths[i];
+		}
+		return bits;
+	}
+};
+
+// Codes of a dynamic block together with the run length encoded code lengths that describe them in the block header
+struct DynamicDeflateHeader {
+	DeflateCodes codes = {};
+	int literalCount = 257;
+	int distanceCount = 1;
+	int codeLengthCount = 4;
+	std::array<uint8_t, codeCodingReorder.size()> codeLengthLengths = {};
+	std::array<uint16_t, codeCodingReorder.size()> codeLengthCodes = {};
+	std::vector<DeflateToken> encodedLengths = {}; // The code length symbol and its extra bits value
+	int64_t headerBits = 0;
+
+	DynamicDeflateHeader(const DeflateStatistics& statistics) {
+		buildCodeLengths(statistics.literals, std::span(codes.literalLengths).first(maxLiteralCodes), 15);
+		buildCodeLengths(statistics.distances, std::span(codes.distanceLengths).first(maxDistanceCodes), 15);
+		buildCodes(codes.literalLengths, codes.literalCodes);
+		buildCodes(codes.distanceLengths, codes.distanceCodes);
+		while (literalCount < maxLiteralCodes && std::any_of(codes.literalLengths.begin() + literalCount,
+				codes.literalLengths.begin() + maxLiteralCodes, [] (uint8_t length) { return length > 0; }))
+			literalCount++;
+		for (int i = 0; i < maxDistanceCodes; i++) {
+			if (codes.distanceLengths[i] > 0)
+				distanceCount = i + 1;
+		}
+
+		// Run length encoding of the lengths, each table separately like zlib does, because some decoders don't allow runs crossing them
+		auto encodeLengths = [this] (std::span<const uint8_t> lengths) {
+			for (int i = 0; i < std::ssize(lengths); ) {
+				int repeated = 1;
+				while (i + repeated < std::ssize(lengths) && lengths[i + repeated] == lengths[i])
+					repeated++;
+				if (lengths[i] == 0 && repeated >= 11) {
+					repeated = std::min(repeated, 138);
+					encodedLengths.push_back({18, uint16_t(repeated - 11)});
+				} else if (lengths[i] == 0 && repeated >= 3) {
+					encodedLengths.push_back({17, uint16_t(repeated - 3)});
+				} else if (lengths[i] != 0 && repeated >= 4) {
+					encodedLengths.push_back({lengths[i], 0});
+					repeated = std::min(repeated - 1, 6);
+					encodedLengths.push_back({16, uint16_t(repeated - 3)});
+					repeated++;
+				} else {
+					repeated = 1;
+					encodedLengths.push_back({lengths[i], 0});
+				}
+				i += repeated;
+			}
+		};
+		encodeLengths(std::span(codes.literalLengths).first(literalCount));
+		encodeLengths(std::span(codes.distanceLengths).first(distanceCount));
+		std::array<uint32_t, codeCodingReorder.size()> frequencies = {};
+		for (DeflateToken encoded : encodedLengths) {
+			frequencies[encoded.lengthOrLiteral]++;
+		}
+		buildCodeLengths(frequencies, codeLengthLengths, 7);
+		buildCodes(codeLengthLengths, codeLengthCodes);
+		for (int i = 0; i < std::ssize(codeCodingReorder); i++) {
+			if (codeLengthLengths[codeCodingReorder[i]] > 0)
+				codeLengthCount = std::max(codeLengthCount, i + 1);
+		}
+
+		constexpr std::array<int, 19> codeLengthExtraBits = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+		headerBits = 5 + 5 + 4 + 3 * codeLengthCount;
+		for (DeflateToken encoded : encodedLengths) {
+			headerBits += codeLengthLengths[encoded.lengthOrLiteral] + codeLengthExtraBits[encoded.lengthOrLiteral];
+		}
+	}
+
+	void write(BitWriter& writer) const {
+		writer.putBits(literalCount - 257, 5);
+		writer.putBits(distanceCount - 1, 5);
+		writer.putBits(codeLengthCount - 4, 4);
+		for (int i = 0; i < codeLengthCount; i++) {
+			writer.putBits(codeLengthLengths[codeCodingReorder[i]], 3);
+		}
+		for (DeflateToken encoded : encodedLengths) {
+			writer.putBits(codeLengthCodes[encoded.lengthOrLiteral], codeLengthLengths[encoded.lengthOrLiteral]);
+			if (encoded.lengthOrLiteral >= 16) {
+				writer.putBits(encoded.distance, (encoded.lengthOrLiteral == 16) ? 2 : (encoded.lengthOrLiteral == 17) ? 3 : 7);
+			}
+		}
+	}
+};
+
+inline void writeTokens(BitWriter& writer, std::span<const DeflateToken> tokens, const DeflateCodes& codes) {
+	for (DeflateToken token : tokens) {
+		if (token.distance == 0) {
+			writer.putBits(codes.literalCodes[token.lengthOrLiteral], codes.literalLengths[token.lengthOrLiteral]);
+		} else {
+			int lengthIndex = lengthCode(token.lengthOrLiteral);
+			writer.putBits(codes.literalCodes[257 + lengthIndex], codes.literalLengths[257 + lengthIndex]);
+			writer.putBits(token.lengthOrLiteral - lengthBases[lengthIndex], lengthExtraBits[lengthIndex]);
+			int distanceIndex = distanceCode(token.distance);
+			writer.putBits(codes.distanceCodes[distanceIndex], codes.distanceLengths[distanceIndex]);
+			writer.putBits(token.distance - distanceBases[distanceIndex], distanceExtraBits[distanceIndex]);
+		}
+	}
+	writer.putBits(codes.literalCodes[endOfBlockSymbol], codes.literalLengths[endOfBlockSymbol]);
+}
+
+inline void writeStoredBlocks(BitWriter& writer, std::span<const uint8_t> uncompressed, bool last) {
+	do {
+		int size = std::min<int>(uncompressed.size(), 0xffff);
+		writer.putBits(last && size == std::ssize(uncompressed), 1);
+		writer.putBits(0b00, 2);
+		writer.alignToByte();
+		writer.putBits(size, 16);
+		writer.putBits(~size & 0xffff, 16);
+		writer.putAlignedBytes(uncompressed.first(size));
+		uncompressed = uncompressed.subspan(size);
+	} while (!uncompressed.empty());
+}
+
+// Header of a gzip member with no optional fields, the operating system is unknown
+constexpr std::array<uint8_t, 10> basicGzipHeader = { 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff };
+
+// Ends a gzip member after its deflate stream
+inline void writeGzipTrailer(BitWriter& writer, uint32_t crc, uint32_t uncompressedSize) {
+	writer.alignToByte();
+	writer.putBits(crc, 32);
+	writer.putBits(uncompressedSize, 32);
+}
+
+// Size of the tokens written as a block with dynamic or fixed codes, whichever is smaller
+inline int64_t compressedBlockBits(std::span<const DeflateToken> tokens) {
+	DeflateStatistics statistics(tokens);
+	DynamicDeflateHeader dynamicHeader(statistics);
+	return 3 + std::min(dynamicHeader.headerBits + statistics.bitsWith(dynamicHeader.codes), statistics.bitsWith(DeflateCodes::fixed()));
+}
+
+// Writes the tokens as a block of the type that makes it the shortest, the uncompressed data they represent allow storing it without compression
+inline void writeDeflateBlock(BitWriter& writer, std::span<const DeflateToken> tokens, std::span<const uint8_t> uncompressed, bool last) {
+	DeflateStatistics statistics(tokens);
+	DynamicDeflateHeader dynamicHeader(statistics);
+	int64_t dynamicBits = dynamicHeader.headerBits + statistics.bitsWith(dynamicHeader.codes);
+	int64_t fixedBits = statistics.bitsWith(DeflateCodes::fixed());
+	int64_t storedBits = (int64_t(uncompressed.size()) + 5 * (uncompressed.size() / 0xffff + 1)) * 8;
+	bool canBeStored = !uncompressed.empty() || tokens.empty();
+
+	if (canBeStored && storedBits < std::min(dynamicBits, fixedBits)) {
+		writeStoredBlocks(writer, uncompressed, last);
+	} else if (fixedBits <= dynamicBits) {
+		writer.putBits(last, 1);
+		writer.putBits(0b01, 2); // Bits are reversed, it means 0b10
+		writeTokens(writer, tokens, DeflateCodes::fixed());
+	} else {
+		writer.putBits(last, 1);
+		writer.putBits(0b10, 2); // Bits are reversed, it means 0b01
+		dynamicHeader.write(writer);
+		writeTokens(writer, tokens, dynamicHeader.codes);
+	}
+}
+
+// Compresses data into a single final deflate block without looking for repetitions
+inline void writeLiteralDeflateBlock(BitWriter& writer, std::span<const uint8_t> uncompressed) {
+	std::vector<DeflateToken> tokens(uncompressed.size());
+	for (int i = 0; i < std::ssize(uncompressed); i++) {
+		tokens[i].lengthOrLiteral = uncompressed[i];
+	}
+	writeDeflateBlock(writer, tokens, uncompressed, true);
+}
+
+} // namespace Detail
+
+// Position of an independently decompressible gzip member in a file
+struct GzBlockPosition {
+	int64_t compressedOffset = 0;
+	int64_t uncompressedOffset = 0;
+};
+
+// Largest uncompressed size that fits into a BGZF block even if it can't be compressed
+constexpr int bgzfMaxBlockSize = 65280;
+
+// Writes the data as one gzip member with a BGZF extra field holding the size of the member
+inline void writeBgzfBlock(std::span<const uint8_t> uncompressed, const std::function<void(std::span<const uint8_t>)>& output) {
+	if (std::ssize(uncompressed) > bgzfMaxBlockSize) {
+		throw std::logic_error("BGZF block can't hold more than bgzfMaxBlockSize bytes");
+	}
+	Detail::BitWriter writer;
+	constexpr std::array<uint8_t, 16> header = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 'B', 'C', 0x00, 0x00 };
+	writer.putAlignedBytes(header);
+	writer.putBits(0, 16); // Placeholder for the size
+	Detail::writeLiteralDeflateBlock(writer, uncompressed);
+	FastCrc32 crc = {};
+	Detail::writeGzipTrailer(writer, crc(uncompressed), uncompressed.size());
+	std::vector<uint8_t> block = writer.takeCompleteBytes();
+	block[16] = uint8_t(block.size() - 1);
+	block[17] = uint8_t((block.size() - 1) >> 8);
+	output(block);
+}
+
+// Empty block marking the end of a BGZF file
+constexpr std::array<uint8_t, 28> bgzfEndOfFileBlock = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+		0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+// Decompresses the whole archive and writes it again as a BGZF file, a series of gzip members that can be decompressed independently,
+// each holding up to blockSize bytes. Returns where each member starts, the file remains readable by any gzip decompressor.
+template <DecompressionSettings Settings>
+std::vector<GzBlockPosition> transcodeToIndependentBlocks(IDeflateArchive<Settings>& input, const std::function<void(std::span<const uint8_t>)>& output,
+		int blockSize = bgzfMaxBlockSize) {
+	if (blockSize <= 0 || blockSize > bgzfMaxBlockSize) {
+		throw std::logic_error("BGZF block size must be positive and at most bgzfMaxBlockSize");
+	}
+	std::vector<GzBlockPosition> positions;
+	std::vector<uint8_t> block;
+	block.reserve(blockSize);
+	GzBlockPosition position = {};
+	auto writeBlock = [&] () {
+		positions.push_back(position);
+		writeBgzfBlock(block, [&] (std::span<const uint8_t> written) {
+			position.compressedOffset += written.size();
+			output(written);
+		});
+		position.uncompressedOffset += block.size();
+		block.clear();
+	};
+	while (std::optional<std::span<const char>> batch = input.readSome()) {
+		for (std::span<const char> left = *batch; !left.empty(); ) {
+			int adding = std::min<int>(blockSize - block.size(), left.size());
+			block.insert(block.end(), left.begin(), left.begin() + adding);
+			left = left.subspan(adding);
+			if (std::ssize(block) == blockSize) {
+				writeBlock();
+			}
+		}
+	}
+	if (!block.empty() || positions.empty()) {
+		writeBlock();
+	}
+	output(bgzfEndOfFileBlock);
+	return positions;
+}
+
+// Serialises the positions in the .gzi format used by bgzip, little endian count and offset pairs, omitting the first block
+inline std::vector<uint8_t> saveGzBlockIndex(std::span<const GzBlockPosition> positions) {
+	std::vector<uint8_t> result;
+	auto add = [&result] (uint64_t number) {
+		for (int i = 0; i < 8; i++) {
+			result.push_back(uint8_t(number >> (i * 8)));
+		}
+	};
+	std::span<const GzBlockPosition> saved = positions.empty() ? positions : positions.subspan(1);
+	add(saved.size());
+	for (const GzBlockPosition& position : saved) {
+		add(position.compressedOffset);
+		add(position.uncompressedOffset);
+	}
+	return result;
+}
+
+inline std::vector<GzBlockPosition> loadGzBlockIndex(std::span<const uint8_t> data) {
+	uint64_t count = Detail::readLittleEndian<uint64_t>(data, 0);
+	if (data.size() != 8 + count * 16) {
+		throw std::runtime_error("Gzip block index has a wrong size");
+	}
+	std::vector<GzBlockPosition> positions = { GzBlockPosition{} };
+	for (uint64_t i = 0; i < count; i++) {
+		positions.push_back({int64_t(Detail::readLittleEndian<uint64_t>(data, 8 + i * 16)), int64_t(Detail::readLittleEndian<uint64_t>(data, 16 + i * 16))});
+	}
+	return positions;
+}
+
+template <typename T>
+concept CompressionSettings = std::constructible_from<typename T::Checksum> && requires(typename T::Checksum checksum) {
+	int(T::blockSize);
+	int(T::maxChainLength);
+	int(T::niceLength);
+	int(checksum());
+	int(checksum(std::span<const uint8_t>()));
+};
+
+struct DefaultCompressionSettings {
+	constexpr static int blockSize = 65536; // Uncompressed bytes compressed at once (into one deflate block unless optimal parsing splits it), unless flushed sooner
+	constexpr static int maxChainLength = 64; // How many earlier occurrences of the same 3 bytes are tried when searching for a repetition
+	constexpr static int niceLength = 128; // A repetition at least this long is used without looking for a longer one
+	using Checksum = FastCrc32;
+	constexpr static bool fastMatching = false; // If true, only the last occurrence of the same 4 bytes is tried and data without repetitions are skipped faster
+	constexpr static bool optimalParsing = false; // If true, repetitions are chosen by the sizes of their codes rather than greedily and blocks are split where it helps
+	constexpr static int parsingIterations = 0; // How many times optimal parsing is repeated with sizes of codes estimated from the previous result
+	constexpr static int compressionThreads = 1; // How many blocks can be compressed in parallel, 0 means one per processor core
+	constexpr static int resetInterval = 0; // If set, compression starts anew at points defined by the contents, on average after this many bytes (a power of 2)
+};
+
+// Faster than zlib's fastest level, but compresses a bit less
+struct FastCompressionSettings : DefaultCompressionSettings {
+	constexpr static int blockSize = 262144;
+	constexpr static int maxChainLength = 1;
+	constexpr static bool fastMatching = true;
+};
+
+template <typename Settings>
+constexpr bool hasFastMatching() {
+	if constexpr (requires { bool(Settings::fastMatching); }) {
+		return Settings::fastMatching;
+	} else {
+		return false;
+	}
+}
+
+// Compresses better than zlib's best level, but it's many times slower, meant for data that are compressed once and stored for long
+struct BestCompressionSettings : DefaultCompressionSettings {
+	constexpr static int blockSize = 1048576;
+	constexpr static int maxChainLength = 1024;
+	constexpr static int niceLength = 258;
+	constexpr static bool optimalParsing = true;
+	constexpr static int parsingIterations = 5;
+	constexpr static int compressionThreads = 0;
+};
+
+template <typename Settings>
+constexpr bool hasOptimalParsing() {
+	if constexpr (requires { bool(Settings::optimalParsing); }) {
+		return Settings::optimalParsing;
+	} else {
+		return false;
+	}
+}
+
+template <typename Settings>
+constexpr int optimalParsingIterations() {
+	if constexpr (requires { int(Settings::parsingIterations); }) {
+		return Settings::parsingIterations;
+	} else {
+		return 0;
+	}
+}
+
+template <typename Settings>
+constexpr int compressionResetInterval() {
+	if constexpr (requires { int(Settings::resetInterval); }) {
+		static_assert(Settings::resetInterval == 0 || (Settings::resetInterval > 1 && std::has_single_bit(unsigned(Settings::resetInterval))), "Reset interval must be a power of 2");
+		return Settings::resetInterval;
+	} else {
+		return 0;
+	}
+}
+
+template <typename Settings>
+int compressionThreads() {
+	if constexpr (requires { int(Settings::compressionThreads); }) {
+		return (Settings::compressionThreads > 0) ? Settings::compressionThreads : std::max<int>(1, std::thread::hardware_concurrency());
+	} else {
+		return 1;
+	}
+}
+
+namespace Detail {
+
+// Number of equal bytes at the start of both locations, up to the limit
+inline int matchLength(const uint8_t* first, const uint8_t* second, int limit) {
+	int length = 0;
+	while (length + int(sizeof(uint64_t)) <= limit) {
+		uint64_t firstPart = 0;
+		uint64_t secondPart = 0;
+		memcpy(&firstPart, first + length, sizeof(uint64_t));
+		memcpy(&secondPart, second + length, sizeof(uint64_t));
+		if (firstPart != secondPart) {
+			if constexpr (std::endian::native == std::endian::little) {
+				return length + (std::countr_zero(firstPart ^ secondPart) >> 3);
+			} else {
+				return length + (std::countl_zero(firstPart ^ secondPart) >> 3);
+			}
+		}
+		length += sizeof(uint64_t);
+	}
+	while (length < limit && first[length] == second[length]) {
+		length++;
+	}
+	return length;
+}
+
+// Finds repetitions in the data, using chains of earlier positions that started with the same 3 bytes, like zlib
+template <CompressionSettings Settings>
+class MatchFinder {
+	constexpr static int windowSize = 32768;
+	constexpr static int hashBits = 15;
+	constexpr static int maxLength = 258;
+	constexpr static int maxShortMatchDistance = 4096; // Farther repetitions of 3 bytes take more bits than the literals
+
+	constexpr static bool fast = hasFastMatching<Settings>();
+
+	std::vector<uint8_t> data = {}; // Up to the window size of already compressed data, followed by the data to compress
+	int start = 0; // The first byte not compressed yet
+	int hashed = 0; // The first position not added to the chains yet
+	std::vector<int32_t> heads = std::vector<int32_t>(1 << hashBits, -1);
+	std::vector<int32_t> previous = std::vector<int32_t>(fast ? 0 : windowSize, -1); // Indexed by the position modulo window size
+	std::vector<DeflateToken> tokens = {};
+
+	int hashAt(int position) const {
+		uint32_t value = data[position] | (data[position + 1] << 8) | (data[position + 2] << 16);
+		return (value * 2654435761u) >> (32 - hashBits);
+	}
+
+	uint32_t fourBytesAt(int position) const {
+		uint32_t value = 0;
+		memcpy(&value, &data[position], sizeof(value));
+		return value;
+	}
+
+	static int hashOfFour(uint32_t value) {
+		return (value * 2654435761u) >> (32 - hashBits);
+	}
+
+	// Only the last position with the same first 4 bytes is remembered, positions inside repetitions aren't
+	void findRepetitionsFast() {
+		const int end = std::ssize(data);
+		int position = start;
+		int misses = 0;
+		tokens.resize(end - start); // There can't be more tokens than bytes, writing them without checking is faster
+		DeflateToken* token = tokens.data();
+		while (position + int(sizeof(uint32_t)) <= end) {
+			uint32_t current = fourBytesAt(position);
+			int32_t& head = heads[hashOfFour(current)];
+			int32_t candidate = head;
+			head = position;
+			if (candidate >= 0 && position - candidate <= windowSize && fourBytesAt(candidate) == current) {
+				const int limit = std::min(maxLength, end - position);
+				int length = sizeof(uint32_t) + matchLength(&data[candidate + sizeof(uint32_t)], &data[position + sizeof(uint32_t)], limit - sizeof(uint32_t));
+				*token++ = {uint16_t(length), uint16_t(position - candidate)};
+				position += length;
+				misses = 0;
+			} else {
+				// The longer there's no repetition, the more bytes are skipped without searching, like in LZ4
+				int skipping = std::min(1 + (misses >> 5), end - position);
+				for (int i = 0; i < skipping; i++) {
+					*token++ = {data[position + i], 0};
+				}
+				position += skipping;
+				misses++;
+			}
+		}
+		for ( ; position < end; position++) {
+			*token++ = {data[position], 0};
+		}
+		tokens.resize(token - tokens.data());
+		hashed = end;
+	}
+
+	// Calls the function with the length and distance of each repetition at the position that is longer than the ones found before
+	template <typename Found>
+	void searchRepetitions(int position, int end, Found found) {
+		if (position + 2 >= end) {
+			return;
+		}
+		const int limit = std::min(maxLength, end - position);
+		int bestLength = 2;
+		int32_t candidate = heads[hashAt(position)];
+		for (int tried = 0; candidate >= 0 && position - candidate <= windowSize && tried < Settings::maxChainLength; tried++) {
+			if (data[candidate + bestLength] == data[position + bestLength]) { // Can't be longer if this byte differs
+				int length = matchLength(&data[candidate], &data[position], limit);
+				if (length > bestLength) {
+					bestLength = length;
+					found(length, position - candidate);
+					if (length >= Settings::niceLength || length == limit) {
+						break;
+					}
+				}
+			}
+			int32_t next = previous[candidate & (windowSize - 1)];
+			if (next >= candidate) {
+				break; // Overwritten by a later position
+			}
+			candidate = next;
+		}
+	}
+
+	void addToChainsUpTo(int end) {
+		if constexpr (fast) {
+			return; // Positions are added by the search and when the data are marked compressed
+		}
+		end = std::min<int>(end, std::ssize(data) - 2);
+		for ( ; hashed < end; hashed++) {
+			int32_t& head = heads[hashAt(hashed)];
+			previous[hashed & (windowSize - 1)] = head;
+			head = hashed;
+		}
+	}
+
+	// Removes data that can't be referenced anymore, by a multiple of the window size so that the positions in the chains keep their indexes
+	void slide() {
+		int shift = (start - windowSize) & ~(windowSize - 1);
+		if (shift <= 0) {
+			return;
+		}
+		data.erase(data.begin(), data.begin() + shift);
+		start -= shift;
+		hashed -= shift;
+		for (int32_t& position : heads) {
+			position = position >= shift ? position - shift : -1;
+		}
+		for (int32_t& position : previous) {
+			position = position >= shift ? position - shift : -1;
+		}
+	}
+
+public:
+	void add(std::span<const uint8_t> added) {
+		data.insert(data.end(), added.begin(), added.end());
+	}
+
+	int pendingSize() const {
+		return std::ssize(data) - start;
+	}
+
+	std::span<const uint8_t> pending() const {
+		return std::span<const uint8_t>(data).subspan(start);
+	}
+
+	// The pending data preceded by the data they can refer to, historySize() bytes long
+	std::span<const uint8_t> pendingWithHistory() const {
+		return data;
+	}
+
+	int historySize() const {
+		return start;
+	}
+
+	// Lists the repetitions at each pending position, each one longer than the previous ones at the position and the closest one with its length,
+	// repetitions at the position i (counted from the start of pending data) are at indexes from offsets[i] to offsets[i + 1]
+	void findAllRepetitions(std::vector<int>& offsets, std::vector<DeflateToken>& found) {
+		offsets.assign(1, 0);
+		found.clear();
+		const int end = std::ssize(data);
+		for (int position = start; position < end; position++) {
+			addToChainsUpTo(position);
+			searchRepetitions(position, end, [&] (int length, int distance) {
+				found.push_back({uint16_t(length), uint16_t(distance)});
+			});
+			offsets.push_back(found.size());
+		}
+	}
+
+	// Represents all the pending data, repetitions can refer to data compressed earlier
+	std::span<const DeflateToken> findRepetitions() {
+		tokens.clear();
+		if constexpr (fast) {
+			findRepetitionsFast();
+			return tokens;
+		}
+		const int end = std::ssize(data);
+		int position = start;
+		while (position < end) {
+			addToChainsUpTo(position);
+			int bestLength = 0;
+			int bestDistance = 0;
+			searchRepetitions(position, end, [&] (int length, int distance) {
+				bestLength = length;
+				bestDistance = distance;
+			});
+			if (bestLength > 3 || (bestLength == 3 && bestDistance <= maxShortMatchDistance)) {
+				tokens.push_back({uint16_t(bestLength), uint16_t(bestDistance)});
+				position += bestLength;
+			} else {
+				tokens.push_back({data[position], 0});
+				position++;
+			}
+		}
+		return tokens;
+	}
+
+	// Called after the pending data were written
+	void markCompressed() {
+		start = std::ssize(data);
+		if constexpr (fast) {
+			// The search skips positions, so the whole window is hashed again, the same way as a new block with the same history
+			for (hashed = std::max(0, start - windowSize); hashed + int(sizeof(uint32_t)) <= start; hashed++) {
+				heads[hashOfFour(fourBytesAt(hashed))] = hashed;
+			}
+			hashed = start;
+		} else {
+			addToChainsUpTo(start);
+		}
+		slide();
+	}
+};
+
+// Estimated numbers of bits needed to write each symbol, including the extra bits
+struct SymbolCosts {
+	std::array<float, 256> literals = {};
+	std::array<float, 259> lengths = {}; // Indexed by the length of a repetition
+	std::array<float, maxDistanceCodes> distances = {}; // Indexed by the distance code
+
+	void setLengthsAndDistances(auto literalOrLengthCost, auto distanceCodeCost) {
+		for (int i = 0; i < std::ssize(literals); i++) {
+			literals[i] = literalOrLengthCost(i);
+		}
+		for (int length = 3; length < std::ssize(lengths); length++) {
+			int code = lengthCode(length);
+			lengths[length] = literalOrLengthCost(257 + code) + lengthExtraBits[code];
+		}
+		for (int code = 0; code < maxDistanceCodes; code++) {
+			distances[code] = distanceCodeCost(code) + distanceExtraBits[code];
+		}
+	}
+
+	SymbolCosts(const DeflateCodes& codes) {
+		setLengthsAndDistances([&] (int symbol) { return float(codes.literalLengths[symbol]); },
+				[&] (int code) { return float(codes.distanceLengths[code]); });
+	}
+
+	// Entropy of the symbols, unused symbols are given a cost a bit higher than the rarest ones could have
+	SymbolCosts(const DeflateStatistics& statistics) {
+		float literalTotal = std::log2(float(std::accumulate(statistics.literals.begin(), statistics.literals.end(), 0.0)));
+		float distanceTotal = std::log2(float(std::max(1.0, std::accumulate(statistics.distances.begin(), statistics.distances.end(), 0.0))));
+		setLengthsAndDistances([&] (int symbol) { return literalTotal - std::log2(std::max(float(statistics.literals[symbol]), 0.5f)); },
+				[&] (int code) { return distanceTotal - std::log2(std::max(float(statistics.distances[code]), 0.5f)); });
+	}
+};
+
+// Chooses the combination of literals and the repetitions found at each position that costs the least bits, by dynamic programming,
+// repetitions reaching beyond the data are shortened
+inline void parseOptimally(std::span<const uint8_t> data, std::span<const int> offsets, std::span<const DeflateToken> repetitions, int niceLength,
+		const SymbolCosts& costs, std::vector<DeflateToken>& tokens) {
+	const int size = std::ssize(data);
+	std::vector<float> cheapest(size + 1, std::numeric_limits<float>::max());
+	std::vector<DeflateToken> chosen(size + 1); // The last token of the cheapest way to reach each position
+	cheapest[0] = 0;
+	for (int position = 0; position < size; position++) {
+		float literalCost = cheapest[position] + costs.literals[data[position]];
+		if (literalCost < cheapest[position + 1]) {
+			cheapest[position + 1] = literalCost;
+			chosen[position + 1] = {data[position], 0};
+		}
+		int shortest = 3;
+		for (int i = offsets[position]; i < offsets[position + 1] && shortest <= size - position; i++) {
+			DeflateToken repetition = repetitions[i];
+			int longest = std::min<int>(repetition.lengthOrLiteral, size - position);
+			if (longest >= niceLength) {
+				shortest = longest; // Shorter ones are unlikely to help and trying them all would be slow in long runs
+			}
+			float distanceCost = cheapest[position] + costs.distances[distanceCode(repetition.distance)];
+			for (int length = shortest; length <= longest; length++) {
+				float cost = distanceCost + costs.lengths[length];
+				if (cost < cheapest[position + length]) {
+					cheapest[position + length] = cost;
+					chosen[position + length] = {uint16_t(length), repetition.distance};
+				}
+			}
+			shortest = longest + 1;
+		}
+	}
+
+	tokens.clear();
+	for (int position = size; position > 0; ) {
+		DeflateToken token = chosen[position];
+		tokens.push_back(token);
+		position -= (token.distance == 0) ? 1 : token.lengthOrLiteral;
+	}
+	std::reverse(tokens.begin(), tokens.end());
+}
+
+// Finds where to split the tokens into blocks so that they are smaller in total, returns the indexes of the first tokens of blocks,
+// followed by the number of tokens; a split point is searched by narrowing the range around the best of several evenly spaced points
+inline std::vector<size_t> findBlockSplits(std::span<const DeflateToken> tokens) {
+	constexpr size_t minBlockTokens = 1024;
+	constexpr int triedPoints = 9;
+	std::vector<size_t> splits;
+	auto split = [&] (auto& split, size_t from, size_t to, int64_t bits) -> void {
+		if (to - from < minBlockTokens * 2) {
+			splits.push_back(from);
+			return;
+		}
+		size_t low = from + minBlockTokens;
+		size_t high = to - minBlockTokens;
+		size_t best = low;
+		int64_t bestBits = std::numeric_limits<int64_t>::max();
+		int64_t bestFirstBits = 0;
+		while (true) {
+			size_t step = std::max<size_t>(1, (high - low) / (triedPoints + 1));
+			size_t bestIndex = 0;
+			std::array<size_t, triedPoints> points = {};
+			for (int i = 0; i < triedPoints; i++) {
+				points[i] = std::min(high, low + step * (i + 1));
+				int64_t firstBits = compressedBlockBits(tokens.subspan(from, points[i] - from));
+				int64_t splitBits = firstBits + compressedBlockBits(tokens.subspan(points[i], to - points[i]));
+				if (splitBits < bestBits) {
+					bestBits = splitBits;
+					bestFirstBits = firstBits;
+					best = points[i];
+					bestIndex = i;
+				}
+			}
+			if (step <= minBlockTokens / 16) {
+				break;
+			}
+			low = (bestIndex > 0) ? points[bestIndex - 1] : low;
+			high = (bestIndex < triedPoints - 1) ? points[bestIndex + 1] : high;
+		}
+		if (bestBits < bits) {
+			split(split, from, best, bestFirstBits);
+			split(split, best, to, bestBits - bestFirstBits);
+		} else {
+			splits.push_back(from);
+		}
+	};
+	split(split, 0, tokens.size(), compressedBlockBits(tokens));
+	splits.push_back(tokens.size());
+	return splits;
+}
+
+// Compresses all pending data, the last block is marked as the final one if last is set
+template <CompressionSettings Settings>
+void compressPendingData(BitWriter& writer, MatchFinder<Settings>& matchFinder, bool last) {
+	if constexpr (!hasOptimalParsing<Settings>()) {
+		writeDeflateBlock(writer, matchFinder.findRepetitions(), matchFinder.pending(), last);
+	} else {
+		// Blocks are split using the codes of the whole data, then the repetitions are chosen again using the codes of each block
+		std::span<const uint8_t> data = matchFinder.pending();
+		std::vector<int> offsets;
+		std::vector<DeflateToken> repetitions;
+		matchFinder.findAllRepetitions(offsets, repetitions);
+		std::vector<DeflateToken> tokens;
+		parseOptimally(data, offsets, repetitions, Settings::niceLength, SymbolCosts(DeflateCodes::fixed()), tokens);
+		parseOptimally(data, offsets, repetitions, Settings::niceLength, SymbolCosts(DeflateStatistics(tokens)), tokens);
+		std::vector<size_t> splits = findBlockSplits(tokens);
+
+		std::vector<DeflateToken> best;
+		std::vector<DeflateToken> parsed;
+		int blockStart = 0;
+		for (int block = 0; block + 1 < std::ssize(splits); block++) {
+			best.assign(tokens.begin() + splits[block], tokens.begin() + splits[block + 1]);
+			int blockSize = 0;
+			for (DeflateToken token : best) {
+				blockSize += (token.distance == 0) ? 1 : token.lengthOrLiteral;
+			}
+			std::span<const uint8_t> blockData = data.subspan(blockStart, blockSize);
+			std::span<const int> blockOffsets = std::span<const int>(offsets).subspan(blockStart, blockSize + 1);
+			int64_t bestBits = compressedBlockBits(best);
+			parsed = best;
+			for (int iteration = 0; iteration < optimalParsingIterations<Settings>(); iteration++) {
+				parseOptimally(blockData, blockOffsets, repetitions, Settings::niceLength, SymbolCosts(DeflateStatistics(parsed)), parsed);
+				int64_t bits = compressedBlockBits(parsed);
+				if (bits >= bestBits) {
+					break;
+				}
+				bestBits = bits;
+				best = parsed;
+			}
+			writeDeflateBlock(writer, best, blockData, last && block + 2 == std::ssize(splits));
+			blockStart += blockSize;
+		}
+	}
+	matchFinder.markCompressed();
+}
+
+// Random numbers for a rolling hash of the last 64 bytes, (hash << 1) + gearHashTable[byte], as in FastCDC
+constexpr std::array<uint64_t, 256> gearHashTable = [] {
+	std::array<uint64_t, 256> result = {};
+	uint64_t state = 0;
+	for (uint64_t& number : result) {
+		state += 0x9e3779b97f4a7c15; // SplitMix64
+		uint64_t mixed = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9;
+		mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111eb;
+		number = mixed ^ (mixed >> 31);
+	}
+	return result;
+}();
+
+} // namespace Detail
+
+// Compresses data into the deflate format, without any headers, the output is given to a function
+template <CompressionSettings Settings = DefaultCompressionSettings>
+class ODeflateArchive {
+protected:
+	std::function<void(std::span<const uint8_t> written)> writeOutput;
+	Detail::MatchFinder<Settings> matchFinder = {};
+	Detail::BitWriter writer = {};
+	typename Settings::Checksum checksum = {};
+	int64_t uncompressedSize = 0;
+	bool finished = false;
+	int threads = compressionThreads<Settings>();
+	int64_t compressedSize = 0; // Only the bytes already given to the output
+	uint64_t rollingHash = 0;
+	int64_t sinceReset = 0;
+	std::vector<GzBlockPosition> resets = {};
+
+	virtual void onFinish() {}
+
+	// Like Z_FULL_FLUSH in zlib, the data written afterwards don't refer to anything before, so they can be decompressed from there
+	void resetCompression() {
+		compressPending(false);
+		Detail::writeStoredBlocks(writer, {}, false);
+		matchFinder = {};
+		sinceReset = 0;
+		resets.push_back({compressedSize + writer.bitsWritten() / 8, uncompressedSize});
+		writeCompleteBytes();
+	}
+
+	void compressPending(bool last) {
+		if (threads == 1 || matchFinder.pendingSize() <= Settings::blockSize) {
+			Detail::compressPendingData(writer, matchFinder, last);
+			return;
+		}
+
+		// Each block gets its own match finder, starting with the data before it that can be referred to, so the result is the same
+		std::span<const uint8_t> data = matchFinder.pendingWithHistory();
+		std::vector<std::future<Detail::BitWriter>> blocks;
+		for (int start = matchFinder.historySize(); start < std::ssize(data); start += Settings::blockSize) {
+			int historyStart = std::max(0, start - 32768);
+			int end = std::min<int>(start + Settings::blockSize, data.size());
+			blocks.push_back(std::async(std::launch::async, [=, lastBlock = last && end == std::ssize(data)] {
+				Detail::MatchFinder<Settings> blockMatchFinder;
+				blockMatchFinder.add(data.subspan(historyStart, start - historyStart));
+				blockMatchFinder.markCompressed();
+				blockMatchFinder.add(data.subspan(start, end - start));
+				Detail::BitWriter blockWriter;
+				Detail::compressPendingData(blockWriter, blockMatchFinder, lastBlock);
+				return blockWriter;
+			}));
+		}
+		for (std::future<Detail::BitWriter>& block : blocks) {
+			writer.putWritten(block.get());
+		}
+		matchFinder.markCompressed();
+	}
+
+	void useDictionary(std::span<const char> dictionary) {
+		dictionary = dictionary.last(std::min<size_t>(dictionary.size(), 32768));
+		matchFinder.add(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(dictionary.data()), dictionary.size()));
+		matchFinder.markCompressed();
+	}
+
+	void writeCompleteBytes() {
+		std::vector<uint8_t> written = writer.takeCompleteBytes();
+		if (!written.empty()) {
+			compressedSize += written.size();
+			writeOutput(written);
+		}
+	}
+
+public:
+	// The data may refer to a preset dictionary, decompression needs the same dictionary then
+	ODeflateArchive(std::function<void(std::span<const uint8_t> written)> writeFunction, std::span<const char> dictionary = {}) : writeOutput(writeFunction) {
+		useDictionary(dictionary);
+	}
+
+	ODeflateArchive(const std::string& fileName, std::span<const char> dictionary = {}) : writeOutput([file = std::make_shared<std::ofstream>(fileName, std::ios::binary)]
+			(std::span<const uint8_t> written) {
+		if (!file->is_open()) {
+			throw std::runtime_error("Can't write file");
+		}
+		file->write(reinterpret_cast<const char*>(written.data()), written.size());
+		file->flush(); // Data are written only after a block is complete or a flush is requested
+	}) {
+		useDictionary(dictionary);
+	}
+
+	virtual ~ODeflateArchive() = default;
+
+	// The data are compressed in blocks, so only some of them may be written before flush() or finish()
+	void write(std::span<const char> data) {
+		if (finished) [[unlikely]] {
+			throw std::logic_error("Writing into a finished archive");
+		}
+		std::span<const uint8_t> bytes(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+		checksum(bytes);
+		const int64_t compressedAtOnce = int64_t(Settings::blockSize) * threads;
+		while (!bytes.empty()) {
+			int adding = std::min<int64_t>(bytes.size(), compressedAtOnce - matchFinder.pendingSize());
+			bool resetting = false;
+			if constexpr (constexpr int interval = compressionResetInterval<Settings>(); interval > 0) {
+				// Like gzip --rsyncable, the points depend only on the last few bytes, so the output after them isn't affected by changes before them
+				constexpr int bits = std::countr_zero(unsigned(interval));
+				for (int i = 0; i < adding; i++) {
+					rollingHash = (rollingHash << 1) + Detail::gearHashTable[bytes[i]];
+					sinceReset++;
+					if ((rollingHash >> (64 - bits)) == 0 && sinceReset >= interval / 4) {
+						adding = i + 1;
+						resetting = true;
+						break;
+					}
+				}
+			}
+			matchFinder.add(bytes.first(adding));
+			uncompressedSize += adding;
+			bytes = bytes.subspan(adding);
+			if (resetting) {
+				resetCompression();
+			} else if (matchFinder.pendingSize() >= compressedAtOnce) {
+				compressPending(false);
+				writeCompleteBytes();
+			}
+		}
+	}
+
+	// Writes everything given so far and ends with an empty stored block that aligns the output to bytes, like Z_SYNC_FLUSH in zlib
+	// The data written later may still refer to the data written before
+	void flush() {
+		if (finished) [[unlikely]] {
+			throw std::logic_error("Flushing a finished archive");
+		}
+		if (matchFinder.pendingSize() > 0) {
+			compressPending(false);
+		}
+		Detail::writeStoredBlocks(writer, {}, false);
+		writeCompleteBytes();
+	}
+
+	// Writes the last block, nothing can be written afterwards
+	void finish() {
+		if (finished) {
+			return;
+		}
+		compressPending(true);
+		writer.alignToByte();
+		onFinish();
+		writeCompleteBytes();
+		finished = true;
+	}
+
+	typename Settings::Checksum& getChecksum() {
+		return checksum;
+	}
+
+	// Positions in the output where compression was reset because of resetInterval, decompression can start there with no earlier data
+	const std::vector<GzBlockPosition>& resetPositions() const {
+		return resets;
+	}
+};
+
+// Compresses data into a .gz file, finish() must be called to write its end
+template <CompressionSettings Settings = DefaultCompressionSettings>
+class OGzFile : public ODeflateArchive<Settings> {
+	using Deflate = ODeflateArchive<Settings>;
+
+	void onFinish() override {
+		Detail::writeGzipTrailer(Deflate::writer, Deflate::checksum(), uint32_t(Deflate::uncompressedSize));
+	}
+
+public:
+	OGzFile(std::function<void(std::span<const uint8_t> written)> writeFunction) : Deflate(writeFunction) {
+		Deflate::writer.putAlignedBytes(Detail::basicGzipHeader);
+	}
+	OGzFile(const std::string& fileName) : Deflate(fileName) {
+		Deflate::writer.putAlignedBytes(Detail::basicGzipHeader);
+	}
+};
+
+namespace Detail {
+// Zlib streams use a different checksum than gzip files
+template <CompressionSettings Settings>
+struct ZlibCompressionSettings : Settings {
+	using Checksum = Adler32;
+};
+
+inline void putBigEndian(BitWriter& writer, uint32_t number) {
+	for (int i = 3; i >= 0; i--) {
+		writer.putBits((number >> (i * 8)) & 0xff, 8);
+	}
+}
+}
+
+// Compresses data into a zlib stream, optionally with a preset dictionary, finish() must be called to write its end
+template <CompressionSettings Settings = DefaultCompressionSettings>
+class OZlibFile : public ODeflateArchive<Detail::ZlibCompressionSettings<Settings>> {
+	using Deflate = ODeflateArchive<Detail::ZlibCompressionSettings<Settings>>;
+
+	void writeHeader(std::span<const char> dictionary) {
+		uint8_t method = 0x78; // Deflate with a 32 kiB window
+		uint8_t flags = 0x80 | (dictionary.empty() ? 0 : 0x20); // Default compression level
+		int remainder = ((method << 8) | flags) % 31;
+		flags += (remainder > 0) ? 31 - remainder : 0;
+		Deflate::writer.putAlignedBytes(std::array<uint8_t, 2>{method, flags});
+		if (!dictionary.empty()) {
+			Detail::putBigEndian(Deflate::writer, Adler32()(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(dictionary.data()), dictionary.size())));
+		}
+	}
+
+	void onFinish() override {
+		Detail::putBigEndian(Deflate::writer, Deflate::checksum());
+	}
+
+public:
+	OZlibFile(std::function<void(std::span<const uint8_t> written)> writeFunction, std::span<const char> dictionary = {}) : Deflate(writeFunction, dictionary) {
+		writeHeader(dictionary);
+	}
+	OZlibFile(const std::string& fileName, std::span<const char> dictionary = {}) : Deflate(fileName, dictionary) {
+		writeHeader(dictionary);
+	}
+};
+
+namespace Detail {
+inline IGzFileInfo parseGzHeader(std::span<const uint8_t> file) {
+	ByteInput<DefaultDecompressionSettings> input(readFromSpan(file));
+	return IGzFileInfo(input);
+}
+
+// Positions in a deflate stream needed to continue it with another one
+struct DeflateStreamLayout {
+	int64_t lastBlockBit = 0; // The bit that marks the last block
+	int64_t endBit = 0;
+	int64_t uncompressedSize = 0;
+};
+
+// Decompresses the stream only to find where its blocks are, the data may continue after its end
+inline DeflateStreamLayout findDeflateLayout(std::span<const uint8_t> stream) {
+	struct LayoutSettings : DefaultDecompressionSettings {
+		using Checksum = NoChecksum;
+	};
+	DeflateStreamLayout layout;
+	ByteInput<LayoutSettings> input(readFromSpan(stream));
+	ByteOutput<LayoutSettings> output;
+	DeflateReader reader(input, output);
+	reader.blockObserver = [&layout] (const DeflateBlockInfo& block) {
+		layout.lastBlockBit = block.compressedBitOffset;
+	};
+	bool workToDo = false;
+	do {
+		workToDo = reader.parseSome();
+		layout.uncompressedSize += output.consume().size();
+	} while (workToDo || output.hasUnconsumed());
+	layout.endBit = *reader.endPosition();
+	return layout;
+}
+
+// Continues the written deflate stream with another one, the last block of the previous one isn't marked as last and an empty stored block
+// restores byte alignment, so that the next one can be copied as whole bytes. Returns the number of bytes used from the appended stream.
+inline int64_t appendDeflateStream(BitWriter& writer, std::span<const uint8_t> stream, const DeflateStreamLayout& layout, bool last) {
+	const int64_t wholeBytes = last ? (layout.endBit + 7) / 8 : layout.endBit / 8;
+	const int64_t flagByte = last ? wholeBytes : layout.lastBlockBit / 8;
+	writer.putAlignedBytes(stream.first(std::min(flagByte, wholeBytes)));
+	if (flagByte < wholeBytes) {
+		writer.putBits(stream[flagByte] & ~(1 << (layout.lastBlockBit % 8)), 8);
+		writer.putAlignedBytes(stream.subspan(flagByte + 1, wholeBytes - flagByte - 1));
+	}
+	if (!last) {
+		if (int bitsLeft = layout.endBit % 8; bitsLeft > 0) {
+			uint8_t partial = stream[wholeBytes];
+			if (flagByte == wholeBytes) {
+				partial &= ~(1 << (layout.lastBlockBit % 8));
+			}
+			writer.putBits(partial & ((1 << bitsLeft) - 1), bitsLeft);
+		}
+		writeStoredBlocks(writer, {}, false);
+	}
+	return (layout.endBit + 7) / 8;
+}
+}
+
+// Joins gzip files into one file with one deflate stream without recompressing them, they are decompressed only to find the ends of their streams.
+// The checksum is combined from theirs. Each file must have only one member (if not, its members can be simply concatenated).
+inline void joinGzFiles(std::span<const std::span<const uint8_t>> files, std::function<void(std::span<const uint8_t> written)> writeOutput) {
+	Detail::BitWriter writer;
+	writer.putAlignedBytes(Detail::basicGzipHeader);
+	uint32_t crc = 0;
+	uint32_t size = 0;
+	for (int i = 0; i < std::ssize(files); i++) {
+		std::span<const uint8_t> stream = files[i].subspan(Detail::parseGzHeader(files[i]).headerSize);
+		Detail::DeflateStreamLayout layout = Detail::findDeflateLayout(stream);
+		int64_t used = Detail::appendDeflateStream(writer, stream, layout, i + 1 == std::ssize(files));
+		if (std::ssize(stream) != used + 8) {
+			throw std::runtime_error("Only gzip files with one member can be joined");
+		}
+		crc = FastCrc32::combine(crc, Detail::readLittleEndian<uint32_t>(stream, used), layout.uncompressedSize);
+		size += layout.uncompressedSize; // Modulo 2^32
+		writeOutput(writer.takeCompleteBytes());
+	}
+	if (files.empty()) {
+		Detail::writeStoredBlocks(writer, {}, true);
+	}
+	Detail::writeGzipTrailer(writer, crc, size);
+	writeOutput(writer.takeCompleteBytes());
+}
+
+// Joins zlib streams into one without recompressing them, like joinGzFiles(), they must not use preset dictionaries
+inline void joinZlibStreams(std::span<const std::span<const uint8_t>> streams, std::function<void(std::span<const uint8_t> written)> writeOutput) {
+	Detail::BitWriter writer;
+	writer.putAlignedBytes(std::array<uint8_t, 2>{0x78, 0x9c}); // Default compression level
+	uint32_t checksum = Adler32()();
+	for (int i = 0; i < std::ssize(streams); i++) {
+		if (streams[i].size() < 2 || !IZlibFile<>::isZlibHeader(streams[i][0], streams[i][1])) {
+			throw std::runtime_error("Trying to join something that isn't a zlib stream");
+		}
+		if (streams[i][1] & 0x20) {
+			throw std::runtime_error("Zlib streams with preset dictionaries can't be joined");
+		}
+		std::span<const uint8_t> stream = streams[i].subspan(2);
+		Detail::DeflateStreamLayout layout = Detail::findDeflateLayout(stream);
+		int64_t used = Detail::appendDeflateStream(writer, stream, layout, i + 1 == std::ssize(streams));
+		if (std::ssize(stream) < used + 4) {
+			throw std::runtime_error("Truncated zlib stream");
+		}
+		uint32_t streamChecksum = 0;
+		for (int byte = 0; byte < 4; byte++) {
+			streamChecksum = (streamChecksum << 8) | stream[used + byte];
+		}
+		checksum = Adler32::combine(checksum, streamChecksum, layout.uncompressedSize);
+		writeOutput(writer.takeCompleteBytes());
+	}
+	if (streams.empty()) {
+		Detail::writeStoredBlocks(writer, {}, true);
+	}
+	writer.alignToByte();
+	Detail::putBigEndian(writer, checksum);
+	writeOutput(writer.takeCompleteBytes());
+}
+
+namespace Detail {
+// Appends bits from any position in the data to the writer's bit position
+inline void copyBits(BitWriter& writer, std::span<const uint8_t> data, int64_t from, int64_t to) {
+	if (int misaligned = from % 8; misaligned > 0 && from < to) {
+		int bits = std::min<int64_t>(8 - misaligned, to - from);
+		writer.putBits((data[from / 8] >> misaligned) & ((1 << bits) - 1), bits);
+		from += bits;
+	}
+	for ( ; to - from >= 32; from += 32) {
+		writer.putBits(readLittleEndian<uint32_t>(data, from / 8), 32);
+	}
+	for ( ; to - from >= 8; from += 8) {
+		writer.putBits(data[from / 8], 8);
+	}
+	if (from < to) {
+		writer.putBits(data[from / 8] & ((1 << (to - from)) - 1), to - from);
+	}
+}
+
+// Compresses the data as if the history was compressed right before them
+template <CompressionSettings Settings>
+void compressAfter(BitWriter& writer, std::span<const uint8_t> history, std::span<const uint8_t> data, bool last) {
+	MatchFinder<Settings> matchFinder;
+	matchFinder.add(history.last(std::min<size_t>(history.size(), 32768)));
+	matchFinder.markCompressed();
+	do {
+		std::span<const uint8_t> part = data.first(std::min<size_t>(data.size(), Settings::blockSize));
+		data = data.subspan(part.size());
+		matchFinder.add(part);
+		compressPendingData(writer, matchFinder, last && data.empty());
+	} while (!data.empty());
+}
+}
+
+// Cuts a range of the uncompressed data out of a gzip file as a new gzip file. The file is decompressed only until the end of the range.
+// Blocks inside the range that can't refer to data before it are copied as they are, only the data near the ends of the range are compressed again.
+template <CompressionSettings Settings = DefaultCompressionSettings>
+void extractGzRange(std::span<const uint8_t> file, int64_t offset, int64_t length, std::function<void(std::span<const uint8_t> written)> writeOutput) {
+	if (offset < 0 || length < 0 || length > std::numeric_limits<int64_t>::max() - offset) {
+		throw std::logic_error("Extracting a range with a negative offset or length");
+	}
+	struct BlockStart {
+		int64_t bit = 0;
+		int64_t uncompressedOffset = 0;
+		DeflateBlockType type = DeflateBlockType::STORED;
+	};
+	std::vector<BlockStart> blocks;
+	IGzFile<> input(file);
+	input.setBlockObserver([&blocks] (const DeflateBlockInfo& block) {
+		blocks.push_back({block.compressedBitOffset, block.uncompressedOffset, block.type});
+	});
+
+	Detail::BitWriter writer;
+	writer.putAlignedBytes(Detail::basicGzipHeader);
+	FastCrc32 crc;
+	const int64_t end = offset + length;
+	std::vector<uint8_t> kept; // Data of the range that weren't written yet, preceded by up to 32 kiB of those that were
+	int64_t keptStart = offset; // Uncompressed offset of the first kept byte
+	int64_t unwrittenStart = offset;
+	int64_t returned = 0;
+	int handledBlocks = 0;
+	auto compressUnwritten = [&] (int64_t until, bool last) {
+		std::span<const uint8_t> keptData(kept);
+		Detail::compressAfter<Settings>(writer, keptData.first(unwrittenStart - keptStart), keptData.subspan(unwrittenStart - keptStart, until - unwrittenStart), last);
+		unwrittenStart = until;
+	};
+	auto forgetWritten = [&] {
+		int64_t forgetting = std::max<int64_t>(unwrittenStart - keptStart - 32768, 0);
+		kept.erase(kept.begin(), kept.begin() + forgetting);
+		keptStart += forgetting;
+		writeOutput(writer.takeCompleteBytes());
+	};
+
+	while (returned < end) {
+		std::optional<std::span<const char>> batch = input.readSome();
+		if (!batch) {
+			break;
+		}
+		int64_t batchStart = returned;
+		returned += batch->size();
+		if (returned > offset) {
+			int64_t from = std::max(batchStart, offset) - batchStart;
+			int64_t to = std::min(returned, end) - batchStart;
+			std::span<const uint8_t> inRange(reinterpret_cast<const uint8_t*>(batch->data()) + from, to - from);
+			crc(inRange);
+			kept.insert(kept.end(), inRange.begin(), inRange.end());
+		}
+
+		// All blocks except the last one that started are complete and their data were returned
+		for ( ; handledBlocks + 1 < std::ssize(blocks); handledBlocks++) {
+			const BlockStart& block = blocks[handledBlocks];
+			const BlockStart& next = blocks[handledBlocks + 1];
+			if (block.uncompressedOffset < std::max(offset + 32768, unwrittenStart) || next.uncompressedOffset > end) {
+				continue; // Might refer to data before the range, doesn't fit into it or its start was already written
+			}
+			if (unwrittenStart < block.uncompressedOffset) {
+				compressUnwritten(block.uncompressedOffset, false);
+			}
+			if (block.type == DeflateBlockType::STORED && (writer.bitsWritten() - block.bit) % 8 != 0) {
+				// The padding before stored data depends on the bit position, so the data are stored anew
+				std::span<const uint8_t> stored = std::span<const uint8_t>(kept).subspan(block.uncompressedOffset - keptStart,
+						next.uncompressedOffset - block.uncompressedOffset);
+				if (!stored.empty()) {
+					Detail::writeStoredBlocks(writer, stored, false);
+				}
+			} else {
+				Detail::copyBits(writer, file, block.bit, next.bit);
+			}
+			unwrittenStart = next.uncompressedOffset;
+			forgetWritten();
+		}
+		if (unwrittenStart - keptStart + int64_t(Settings::blockSize) * 4 < std::ssize(kept)) {
+			compressUnwritten(keptStart + std::ssize(kept), false); // No block could be copied for a long time, can't keep all of it
+			forgetWritten();
+		}
+	}
+	compressUnwritten(keptStart + std::ssize(kept), true);
+	writer.alignToByte();
+	Detail::writeGzipTrailer(writer, crc(), uint32_t(std::clamp<int64_t>(returned - offset, 0, length)));
+	writeOutput(writer.takeCompleteBytes());
+}
+
+namespace Detail {
+// Writes the tokens in blocks split anew, each with its optimal codes, and returns the checksum of the data
+template <typename Checksum, DecompressionSettings Settings>
+uint32_t reencodeTokens(DeflateTokenReader<Settings>& input, BitWriter& writer, const std::function<void(std::span<const uint8_t> written)>& writeOutput) {
+	constexpr size_t segmentTokens = 65536; // Blocks are split within parts of this many tokens, like the compressor does with blockSize
+	std::vector<DeflateToken> pending;
+	std::vector<uint8_t> data; // Decompressed pending tokens, preceded by up to 32 kiB of earlier data, for stored blocks and repetitions
+	size_t pendingStart = 0;
+	Checksum checksum;
+
+	auto writePending = [&] (size_t tokenCount, bool last) {
+		std::span<const DeflateToken> tokens = std::span<const DeflateToken>(pending).first(tokenCount);
+		std::vector<size_t> splits = findBlockSplits(tokens);
+		size_t position = pendingStart;
+		for (int block = 0; block + 1 < std::ssize(splits); block++) {
+			std::span<const DeflateToken> blockTokens = tokens.subspan(splits[block], splits[block + 1] - splits[block]);
+			size_t size = 0;
+			for (DeflateToken token : blockTokens) {
+				size += (token.distance == 0) ? 1 : token.lengthOrLiteral;
+			}
+			writeDeflateBlock(writer, blockTokens, std::span<const uint8_t>(data).subspan(position, size), last && block + 2 == std::ssize(splits));
+			position += size;
+		}
+		pending.erase(pending.begin(), pending.begin() + tokenCount);
+		size_t forgetting = (position > 32768) ? position - 32768 : 0;
+		data.erase(data.begin(), data.begin() + forgetting);
+		pendingStart = position - forgetting;
+		writeOutput(writer.takeCompleteBytes());
+	};
+
+	while (std::optional<std::span<const DeflateToken>> tokens = input.readSome()) {
+		size_t added = data.size();
+		for (DeflateToken token : *tokens) {
+			if (token.distance == 0) {
+				data.push_back(token.lengthOrLiteral);
+			} else {
+				size_t from = data.size() - token.distance; // The distance was checked by the reader
+				for (int i = 0; i < token.lengthOrLiteral; i++) {
+					data.push_back(data[from + i]);
+				}
+			}
+		}
+		checksum(std::span<const uint8_t>(data).subspan(added));
+		pending.insert(pending.end(), tokens->begin(), tokens->end());
+		while (pending.size() > segmentTokens) {
+			writePending(segmentTokens, false);
+		}
+	}
+	writePending(pending.size(), true);
+	return checksum();
+}
+}
+
+// Writes a deflate stream again with the same repetitions, but split into blocks anew, each one with its optimal Huffman codes.
+// It's much faster than compressing it again and helps with data compressed with fixed codes or poorly chosen codes.
+inline void reencodeDeflate(std::span<const uint8_t> compressed, std::function<void(std::span<const uint8_t> written)> writeOutput) {
+	Detail::BitWriter writer;
+	DeflateTokenReader<> input(compressed);
+	Detail::reencodeTokens<NoChecksum>(input, writer, writeOutput);
+	writer.alignToByte();
+	writeOutput(writer.takeCompleteBytes());
+}
+
+// Like reencodeDeflate(), but with a gzip file, which may have multiple members, checksums are verified
+inline void reencodeGzFile(std::span<const uint8_t> file, std::function<void(std::span<const uint8_t> written)> writeOutput) {
+	Detail::BitWriter writer;
+	do {
+		IGzFileInfo header = Detail::parseGzHeader(file);
+		if (header.extraData.has_value()) {
+			writer.putAlignedBytes(Detail::basicGzipHeader); // Extra fields like dictzip's offsets would no longer be valid
+		} else {
+			writer.putAlignedBytes(file.first(header.headerSize));
+		}
+		DeflateTokenReader<> input(file.subspan(header.headerSize));
+		uint32_t crc = Detail::reencodeTokens<FastCrc32>(input, writer, writeOutput);
+		std::span<const uint8_t> trailer = file.subspan(std::min<size_t>(header.headerSize + input.compressedPosition(), file.size()));
+		if (trailer.size() < 8) {
+			throw std::runtime_error("Gzip archive is truncated");
+		}
+		if (Detail::readLittleEndian<uint32_t>(trailer, 0) != crc) {
+			throw std::runtime_error("Gzip archive's crc32 checksum doesn't match the calculated checksum");
+		}
+		if (Detail::readLittleEndian<uint32_t>(trailer, 4) != uint32_t(input.uncompressedPosition())) {
+			throw std::runtime_error("Gzip archive's size doesn't match the size of the decompressed data");
+		}
+		writer.alignToByte();
+		writer.putAlignedBytes(trailer.first(8));
+		writeOutput(writer.takeCompleteBytes());
+		file = trailer.subspan(8);
+	} while (!file.empty());
+}
+
+// Chooses parts of the samples that appear in many of them, to be used as a preset dictionary for compressing many similar short pieces of data.
+// Parts are taken greedily by the number of samples containing their 8 byte sequences that aren't in the dictionary yet (like zstd's cover
+// algorithm), the best ones are placed at the end, where repetitions are the shortest to encode.
+inline std::vector<char> buildDeflateDictionary(std::span<const std::string> samples, int size = 32768) {
+	constexpr int sequenceLength = 8;
+	constexpr int partLength = 64;
+	constexpr int partStep = 16;
+	auto sequenceAt = [] (const std::string& sample, int position) {
+		uint64_t sequence = 0;
+		memcpy(&sequence, sample.data() + position, sizeof(sequence));
+		return sequence;
+	};
+
+	std::unordered_map<uint64_t, int> sampleCounts; // In how many samples each sequence appears
+	std::vector<uint64_t> distinct;
+	for (const std::string& sample : samples) {
+		distinct.clear();
+		for (int position = 0; position + sequenceLength <= std::ssize(sample); position++) {
+			distinct.push_back(sequenceAt(sample, position));
+		}
+		std::sort(distinct.begin(), distinct.end());
+		distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+		for (uint64_t sequence : distinct) {
+			sampleCounts[sequence]++;
+		}
+	}
+
+	// Calls the function with each sequence in the part only once
+	auto forEachSequence = [&] (int sampleIndex, int start, auto function) {
+		const std::string& sample = samples[sampleIndex];
+		std::array<uint64_t, partLength> sequences = {};
+		int count = 0;
+		for (int position = start; position + sequenceLength <= std::min<int>(start + partLength, sample.size()); position++) {
+			sequences[count++] = sequenceAt(sample, position);
+		}
+		std::sort(sequences.begin(), sequences.begin() + count);
+		for (int i = 0; i < count; i++) {
+			if (i == 0 || sequences[i] != sequences[i - 1]) {
+				function(sampleCounts[sequences[i]]);
+			}
+		}
+	};
+	auto score = [&] (int sampleIndex, int start) {
+		int64_t total = 0;
+		forEachSequence(sampleIndex, start, [&] (int& sampleCount) {
+			total += (sampleCount > 1) ? sampleCount : 0; // Sequences in only one sample are useless
+		});
+		return total;
+	};
+
+	// Scores can only decrease as the dictionary grows, so a part needs to be scored again only if it looks like the best one
+	struct Part {
+		int64_t score = 0;
+		int sampleIndex = 0;
+		int start = 0;
+		bool operator<(const Part& other) const {
+			return score < other.score;
+		}
+	};
+	std::priority_queue<Part> parts;
+	for (int sampleIndex = 0; sampleIndex < std::ssize(samples); sampleIndex++) {
+		for (int start = 0; start + sequenceLength <= std::ssize(samples[sampleIndex]); start += partStep) {
+			if (int64_t partScore = score(sampleIndex, start); partScore > 0) {
+				parts.push({partScore, sampleIndex, start});
+			}
+		}
+	}
+	std::vector<std::string_view> chosen;
+	int chosenSize = 0;
+	while (!parts.empty() && chosenSize < size) {
+		Part best = parts.top();
+		parts.pop();
+		int64_t currentScore = score(best.sampleIndex, best.start);
+		if (currentScore < best.score) {
+			if (currentScore > 0) {
+				parts.push({currentScore, best.sampleIndex, best.start});
+			}
+			continue;
+		}
+		std::string_view part = std::string_view(samples[best.sampleIndex]).substr(best.start, partLength);
+		chosen.push_back(part);
+		chosenSize += part.size();
+		forEachSequence(best.sampleIndex, best.start, [] (int& sampleCount) {
+			sampleCount = 0;
+		});
+	}
+
+	std::vector<char> dictionary;
+	for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+		dictionary.insert(dictionary.end(), it->begin(), it->end());
+	}
+	if (std::ssize(dictionary) > size) {
+		dictionary.erase(dictionary.begin(), dictionary.end() - size);
+	}
+	return dictionary;
+}
+
+namespace Detail {
+template <CompressionSettings Settings>
+class OGzStreamBuffer : public std::streambuf {
+	OGzFile<Settings> outputFile;
+	std::array<char, 4096> buffer = {};
+
+	void writeBuffered() {
+		if (pptr() != pbase()) {
+			outputFile.write(std::span<const char>(pbase(), pptr()));
+			setp(buffer.data(), buffer.data() + buffer.size());
+		}
+	}
+
+public:
+	template<typename Arg>
+	OGzStreamBuffer(const Arg& arg) : outputFile(arg) {
+		setp(buffer.data(), buffer.data() + buffer.size());
+	}
+
+	int overflow(int added) override {
+		writeBuffered();
+		if (!traits_type::eq_int_type(added, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(added);
+			pbump(1);
+		}
+		return traits_type::not_eof(added);
+	}
+
+	std::streamsize xsputn(const char* data, std::streamsize size) override {
+		if (size < std::ssize(buffer)) {
+			return std::streambuf::xsputn(data, size);
+		}
+		writeBuffered();
+		outputFile.write(std::span<const char>(data, size)); // Large writes skip the buffer
+		return size;
+	}
+
+	int sync() override {
+		writeBuffered();
+		outputFile.flush();
+		return 0;
+	}
+
+	void finish() {
+		writeBuffered();
+		outputFile.finish();
+	}
+};
+}
+
+// Using OGzFile as std::ostream, flush() (or std::flush or std::endl) writes everything given so far, the file is finished when destroyed
+template <CompressionSettings Settings = DefaultCompressionSettings>
+class BasicOGzStream : private Detail::OGzStreamBuffer<Settings>, public std::ostream
+{
+public:
+	// Write into a file
+	BasicOGzStream(const std::string& targetFile) : Detail::OGzStreamBuffer<Settings>(targetFile), std::ostream(this) {}
+	// Use a function that is called with parts of the compressed output
+	BasicOGzStream(std::function<void(std::span<const uint8_t> written)> writeFunction) : Detail::OGzStreamBuffer<Settings>(writeFunction), std::ostream(this) {}
+	// Write into an existing stream
+	BasicOGzStream(std::ostream& output) : Detail::OGzStreamBuffer<Settings>([&output] (std::span<const uint8_t> written) {
+		output.write(reinterpret_cast<const char*>(written.data()), written.size());
+		output.flush();
+	}), std::ostream(this) {}
+
+	~BasicOGzStream() {
+		try {
+			finish();
+		} catch (...) {} // Can't be reported from a destructor, call finish() to see the errors
+	}
+
+	// Writes the end of the file, nothing can be written afterwards
+	void finish() {
+		Detail::OGzStreamBuffer<Settings>::finish();
+	}
+};
+
+using OGzStream = BasicOGzStream<>;
+
 } // namespace EzGz
 
 #endif // EZGZ_HPP
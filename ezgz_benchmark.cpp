@@ -0,0 +1,166 @@
+//usr/bin/g++ --std=c++20 -Wall $0 -O2 $(echo '#include <zlib.h>' | g++ -E - >/dev/null 2>&1 && echo -lz) -o ${o=`mktemp`} && exec $o $*
+#include "ezgz.hpp"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <sstream>
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define EZGZ_BENCHMARK_ZLIB
+#endif
+
+// Compares the speed and compression ratio of EzGz compression levels with zlib, if available
+// With --messages, each line of the files is compressed separately, with and without a dictionary built from the first lines
+
+namespace {
+
+constexpr int repetitions = 5;
+
+template <typename Compress>
+void measure(const std::string& name, std::span<const char> input, Compress compress) {
+	double bestTime = std::numeric_limits<double>::max();
+	std::vector<uint8_t> compressed;
+	for (int i = 0; i < repetitions; i++) {
+		compressed.clear();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		compress(input, compressed);
+		bestTime = std::min(bestTime, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::vector<char> decompressed = EzGz::IGzFile<>(compressed).readAll();
+	bool correct = std::equal(decompressed.begin(), decompressed.end(), input.begin(), input.end());
+	std::cout << "  " << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(8) << input.size() / bestTime / 1024 / 1024 << " MiB/s" << std::setprecision(3)
+			<< std::setw(8) << double(compressed.size()) / input.size() << " of original size" << (correct ? "" : ", DECOMPRESSED WRONG") << std::endl;
+}
+
+template <EzGz::CompressionSettings Settings>
+void compressWithEzGz(std::span<const char> input, std::vector<uint8_t>& output) {
+	EzGz::OGzFile<Settings> compressor([&] (std::span<const uint8_t> written) {
+		output.insert(output.end(), written.begin(), written.end());
+	});
+	compressor.write(input);
+	compressor.finish();
+}
+
+#ifdef EZGZ_BENCHMARK_ZLIB
+void compressWithZlib(std::span<const char> input, std::vector<uint8_t>& output, int level) {
+	z_stream stream = {};
+	if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		throw std::runtime_error("Can't initialise zlib");
+	}
+	output.resize(deflateBound(&stream, input.size()));
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+	stream.avail_in = input.size();
+	stream.next_out = output.data();
+	stream.avail_out = output.size();
+	int result = deflate(&stream, Z_FINISH);
+	output.resize(stream.total_out);
+	deflateEnd(&stream);
+	if (result != Z_STREAM_END) {
+		throw std::runtime_error("Compression with zlib failed");
+	}
+}
+#endif
+
+constexpr int dictionarySamples = 1000;
+
+template <typename Function>
+double secondsTaken(Function function) {
+	double bestTime = std::numeric_limits<double>::max();
+	for (int i = 0; i < repetitions; i++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		function();
+		bestTime = std::min(bestTime, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return bestTime;
+}
+
+void measureMessages(const std::string& name, std::span<const std::string> messages, std::span<const char> dictionary) {
+	std::vector<std::vector<uint8_t>> compressed(messages.size());
+	size_t compressedSize = 0;
+	size_t originalSize = 0;
+	double compressionTime = secondsTaken([&] {
+		for (int i = 0; i < std::ssize(messages); i++) {
+			compressed[i].clear();
+			EzGz::ODeflateArchive<> compressor([&] (std::span<const uint8_t> written) {
+				compressed[i].insert(compressed[i].end(), written.begin(), written.end());
+			}, dictionary);
+			compressor.write(messages[i]);
+			compressor.finish();
+		}
+	});
+	EzGz::DeflateMessageReader<> reader(dictionary);
+	std::vector<char> decompressed;
+	bool correct = true;
+	double decompressionTime = secondsTaken([&] {
+		for (int i = 0; i < std::ssize(messages); i++) {
+			reader.read(compressed[i], decompressed);
+			correct = correct && std::equal(decompressed.begin(), decompressed.end(), messages[i].begin(), messages[i].end());
+		}
+	});
+	for (int i = 0; i < std::ssize(messages); i++) {
+		compressedSize += compressed[i].size();
+		originalSize += messages[i].size();
+	}
+	std::cout << "  " << std::left << std::setw(18) << name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(8) << double(compressedSize) / originalSize << " of original size" << std::setprecision(0)
+			<< std::setw(10) << messages.size() / compressionTime << " compressed/s" << std::setw(10) << messages.size() / decompressionTime
+			<< " decompressed/s" << (correct ? "" : ", DECOMPRESSED WRONG") << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "Usage: " << argv[0] << " [--messages] files_to_compress..." << std::endl;
+		return 1;
+	}
+	bool messages = (std::string_view(argv[1]) == "--messages");
+
+	for (int i = messages ? 2 : 1; i < argc; i++) {
+		std::ifstream file(argv[i], std::ios::binary);
+		if (!file.is_open()) {
+			std::cout << "Can't read " << argv[i] << std::endl;
+			return 2;
+		}
+		std::vector<char> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		std::cout << argv[i] << ", " << input.size() << " bytes:" << std::endl;
+
+		if (messages) {
+			std::vector<std::string> lines;
+			std::stringstream lineReader(std::string(input.begin(), input.end()));
+			for (std::string line; std::getline(lineReader, line); ) {
+				lines.push_back(line);
+			}
+			if (std::ssize(lines) <= dictionarySamples) {
+				std::cout << "  At least " << dictionarySamples + 1 << " lines are needed" << std::endl;
+				continue;
+			}
+			std::span<const std::string> samples = std::span<const std::string>(lines).first(dictionarySamples);
+			std::span<const std::string> measured = std::span<const std::string>(lines).subspan(dictionarySamples);
+			measureMessages("No dictionary", measured, {});
+			for (int size : {4096, 32768}) {
+				measureMessages(std::to_string(size / 1024) + " kiB dictionary", measured, EzGz::buildDeflateDictionary(samples, size));
+			}
+			continue;
+		}
+
+		measure("EzGz fast", input, compressWithEzGz<EzGz::FastCompressionSettings>);
+		measure("EzGz default", input, compressWithEzGz<EzGz::DefaultCompressionSettings>);
+		measure("EzGz best", input, compressWithEzGz<EzGz::BestCompressionSettings>);
+#ifdef EZGZ_BENCHMARK_ZLIB
+		measure("zlib 1", input, [] (std::span<const char> input, std::vector<uint8_t>& output) {
+			compressWithZlib(input, output, 1);
+		});
+		measure("zlib 6", input, [] (std::span<const char> input, std::vector<uint8_t>& output) {
+			compressWithZlib(input, output, 6);
+		});
+		measure("zlib 9", input, [] (std::span<const char> input, std::vector<uint8_t>& output) {
+			compressWithZlib(input, output, 9);
+		});
+#else
+		std::cout << "  zlib is not available for comparison" << std::endl;
+#endif
+	}
+	return 0;
+}
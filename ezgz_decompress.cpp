@@ -3,36 +3,244 @@
 #include <iostream>
 #include <filesystem>
 #include <chrono>
+#include <deque>
+#include <map>
+#include <cstdio>
 
 // For testing purposes only, gunzip is faster because it can write into files much more efficiently
 
+struct Job {
+	std::string inputName;
+	std::string outputName;
+	ssize_t inputSize = 0;
+};
+
+struct JobResult {
+	ssize_t outputSize = 0;
+	float duration = 0; // In seconds
+	std::string error;
+};
+
+// Each worker takes jobs from the front of its own queue, when empty, it steals from the back of other workers' queues
+class WorkStealingQueues {
+	struct Queue {
+		std::mutex lock;
+		std::deque<int> jobs;
+	};
+	std::vector<Queue> queues;
+
+public:
+	WorkStealingQueues(int workers) : queues(workers) {}
+
+	void add(int worker, int job) {
+		queues[worker].jobs.push_back(job);
+	}
+
+	std::optional<int> take(int worker) {
+		{
+			std::lock_guard lock(queues[worker].lock);
+			if (!queues[worker].jobs.empty()) {
+				int job = queues[worker].jobs.front();
+				queues[worker].jobs.pop_front();
+				return job;
+			}
+		}
+		for (int i = 1; i < std::ssize(queues); i++) {
+			Queue& victim = queues[(worker + i) % queues.size()];
+			std::lock_guard lock(victim.lock);
+			if (!victim.jobs.empty()) {
+				int job = victim.jobs.back();
+				victim.jobs.pop_back();
+				return job;
+			}
+		}
+		return std::nullopt;
+	}
+};
+
+// Decompresses all files given to one thread, the decoder's input and output buffers are allocated only once and reset for each file
+class WorkerDecoder {
+	using Settings = EzGz::DefaultDecompressionSettings;
+	std::ifstream file;
+	EzGz::Detail::ByteInput<Settings> input;
+	EzGz::Detail::ByteOutput<Settings> output;
+	std::vector<char> writeBuffer = std::vector<char>(1 << 20);
+
+public:
+	WorkerDecoder() : input([this] (std::span<uint8_t> batch) -> int {
+		file.read(reinterpret_cast<char*>(batch.data()), batch.size());
+		return file.gcount();
+	}) {}
+	WorkerDecoder(const WorkerDecoder&) = delete; // The input refers to this object
+	WorkerDecoder& operator=(const WorkerDecoder&) = delete;
+
+	JobResult decompress(const Job& job) {
+		JobResult result;
+		std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		bool outputCreated = false;
+		try {
+			file = std::ifstream(job.inputName, std::ios::binary);
+			if (!file.is_open()) {
+				throw std::runtime_error("Can't read file");
+			}
+			input.reset();
+			output.reset();
+			EzGz::IGzFileInfo header(input);
+			std::unique_ptr<FILE, decltype(&fclose)> written(fopen(job.outputName.c_str(), "wb"), &fclose);
+			if (!written) {
+				throw std::runtime_error("Can't open the output file");
+			}
+			outputCreated = true;
+			setvbuf(written.get(), writeBuffer.data(), _IOFBF, writeBuffer.size());
+			EzGz::Detail::DeflateReader reader(input, output);
+			bool workToDo = false;
+			do {
+				workToDo = reader.parseSome();
+				std::span<const char> batch = output.consume();
+				if (fwrite(batch.data(), 1, batch.size(), written.get()) != batch.size()) {
+					throw std::runtime_error("Can't write into the output file");
+				}
+				result.outputSize += batch.size();
+			} while (workToDo || output.hasUnconsumed());
+			if (input.getInteger<uint32_t>() != output.getChecksum()()) {
+				throw std::runtime_error("Gzip archive's crc32 checksum doesn't match the calculated checksum");
+			}
+			if (input.getInteger<uint32_t>() != uint32_t(result.outputSize)) {
+				throw std::runtime_error("Gzip archive's size doesn't match the size of the decompressed data");
+			}
+			if (fclose(written.release()) != 0) {
+				throw std::runtime_error("Can't write into the output file");
+			}
+		} catch (std::exception& error) {
+			result.error = error.what();
+			if (outputCreated) {
+				std::error_code ignored;
+				std::filesystem::remove(job.outputName, ignored); // Don't leave incomplete data that look like a decompressed file
+			}
+		}
+		std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+		result.duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0f;
+		return result;
+	}
+};
+
+float mebibytesPerSecond(ssize_t bytes, float seconds) {
+	return (float(bytes) / (1024 * 1024)) / std::max(seconds, 0.000001f);
+}
+
 int main(int argc, char** argv) {
-	if (argc != 2) {
-		std::cout << "Usage: " << argv[0] << " name_of_file_to_decompress" << std::endl;
+	auto printUsage = [argv] {
+		std::cout << "Usage: " << argv[0] << " [-j number_of_threads] names_of_files_or_directories_to_decompress" << std::endl;
+		std::cout << "Directories are searched recursively for files whose name ends with .gz" << std::endl;
+	};
+	int threadCount = std::max<int>(1, std::thread::hardware_concurrency());
+	std::vector<std::string> inputNames;
+	for (int i = 1; i < argc; i++) {
+		if (std::string_view(argv[i]) == "-j" && i + 1 < argc) {
+			try {
+				threadCount = std::max(1, std::stoi(argv[++i]));
+			} catch (std::exception&) {
+				std::cout << "Not a number of threads: " << argv[i] << std::endl;
+				printUsage();
+				return 1;
+			}
+		} else {
+			inputNames.push_back(argv[i]);
+		}
+	}
+	if (inputNames.empty()) {
+		printUsage();
 		return 1;
 	}
 
-	std::string inputName = argv[1];
-	if (inputName.find(".gz") == std::string::npos) {
-		std::cout << "File name must contain .gz" << std::endl;
+	std::vector<Job> jobs;
+	int failures = 0;
+	auto addJob = [&] (const std::filesystem::path& inputName) {
+		if (inputName.extension() != ".gz") {
+			std::cout << "File name must end with .gz: " << inputName.string() << std::endl;
+			return false;
+		}
+		std::error_code error;
+		ssize_t inputSize = std::filesystem::file_size(inputName, error);
+		if (error) {
+			std::cout << "Failed to decompress " << inputName.string() << ": " << error.message() << std::endl;
+			failures++;
+			return true;
+		}
+		jobs.push_back({inputName.string(), std::filesystem::path(inputName).replace_extension().string(), inputSize});
+		return true;
+	};
+	try {
+		for (const std::string& inputName : inputNames) {
+			if (std::filesystem::is_directory(inputName)) {
+				for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(inputName)) {
+					if (entry.is_regular_file() && entry.path().extension() == ".gz") {
+						addJob(entry.path());
+					}
+				}
+			} else if (!addJob(inputName)) {
+				return 2;
+			}
+		}
+	} catch (std::filesystem::filesystem_error& error) {
+		std::cout << "Can't search for files: " << error.what() << std::endl;
+		printUsage();
 		return 2;
 	}
-	ssize_t inputSize = std::filesystem::file_size(inputName);
-	std::string outputName = inputName.substr(0, inputName.find(".gz"));
 
-	EzGz::IGzStream decompressor(inputName);
-	decompressor.exceptions(std::ifstream::failbit);
-	std::ofstream output(outputName, std::ios::binary);
-	output.exceptions(std::ifstream::failbit);
+	// Largest files first, so that the last files to finish are small and don't keep only one thread working
+	std::sort(jobs.begin(), jobs.end(), [] (const Job& first, const Job& second) {
+		return first.inputSize > second.inputSize;
+	});
+	threadCount = std::min<int>(threadCount, std::max<int>(jobs.size(), 1));
+	WorkStealingQueues queues(threadCount);
+	for (int i = 0; i < std::ssize(jobs); i++) {
+		queues.add(i % threadCount, i);
+	}
 
+	std::vector<JobResult> results(jobs.size());
 	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
-	output << decompressor.rdbuf();
-	output.close();
+	{
+		std::vector<std::jthread> workers;
+		for (int worker = 0; worker < threadCount; worker++) {
+			workers.emplace_back([&, worker] {
+				WorkerDecoder decoder;
+				while (std::optional<int> job = queues.take(worker)) {
+					results[*job] = decoder.decompress(jobs[*job]);
+				}
+			});
+		}
+	}
 	std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
-	std::chrono::microseconds duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
+	float duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count() / 1000000.0f;
 
-	ssize_t outputSize = std::filesystem::file_size(outputName);
-	std::cout << "Compression ratio was " << (float(inputSize) / outputSize * 100) << "%" << std::endl;
-	std::cout << "Decompressed " << outputSize << " bytes at speed " << ((float(outputSize) / (1024 * 1024)) / (float(duration.count()) / 1000000)) << " MiB/s" << std::endl;
+	ssize_t inputSize = 0;
+	ssize_t outputSize = 0;
+	const int fileCount = jobs.size() + failures;
+	std::map<int, int> histogram; // Files by throughput, in power of two buckets of MiB/s
+	for (int i = 0; i < std::ssize(jobs); i++) {
+		if (!results[i].error.empty()) {
+			std::cout << "Failed to decompress " << jobs[i].inputName << ": " << results[i].error << std::endl;
+			failures++;
+			continue;
+		}
+		inputSize += jobs[i].inputSize;
+		outputSize += results[i].outputSize;
+		histogram[std::bit_width(unsigned(mebibytesPerSecond(results[i].outputSize, results[i].duration)))]++;
+	}
 
+	if (fileCount == 1 && failures == 0) {
+		std::cout << "Compression ratio was " << (float(inputSize) / outputSize * 100) << "%" << std::endl;
+		std::cout << "Decompressed " << outputSize << " bytes at speed " << mebibytesPerSecond(outputSize, duration) << " MiB/s" << std::endl;
+		return 0;
+	}
+
+	std::cout << "Decompressed " << (fileCount - failures) << " files out of " << fileCount << " using " << threadCount << " threads" << std::endl;
+	std::cout << "Compression ratio was " << (float(inputSize) / std::max<ssize_t>(outputSize, 1) * 100) << "%" << std::endl;
+	std::cout << "Decompressed " << outputSize << " bytes at speed " << mebibytesPerSecond(outputSize, duration) << " MiB/s" << std::endl;
+	std::cout << "Files by speed of decompression:" << std::endl;
+	for (auto [bucket, count] : histogram) {
+		std::cout << "  " << (bucket == 0 ? 0 : (1 << (bucket - 1))) << " - " << (1 << bucket) << " MiB/s: " << count << std::endl;
+	}
+	return failures > 0 ? 3 : 0;
 }
@@ -0,0 +1,61 @@
+//usr/bin/g++ --std=c++20 -Wall $0 -O2 -o ${o=`mktemp`} && exec $o $*
+#include "ezgz.hpp"
+#include <iostream>
+#include <cstdio>
+
+// Prints lines of .gz files that contain any of the given strings, without regular expressions, like zgrep -F
+
+// Smaller batches stay in cache between decompression and searching
+struct GrepSettings : EzGz::DefaultDecompressionSettings {
+	constexpr static int maxOutputBufferSize = 32768 * 4;
+};
+
+int main(int argc, char** argv) {
+	std::vector<std::string> searched;
+	std::vector<std::string> fileNames;
+	bool wantLineNumbers = false;
+	int64_t maxMatches = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string_view argument = argv[i];
+		if (argument == "-n") {
+			wantLineNumbers = true;
+		} else if (argument == "-m" && i + 1 < argc) {
+			maxMatches = std::stoll(argv[++i]);
+		} else if (argument == "-e" && i + 1 < argc) {
+			searched.push_back(argv[++i]);
+		} else if (searched.empty() && fileNames.empty() && argument != "-e") {
+			searched.push_back(argv[i]);
+		} else {
+			fileNames.push_back(argv[i]);
+		}
+	}
+	if (searched.empty() || fileNames.empty()) {
+		std::cout << "Usage: " << argv[0] << " [-n] [-m max_count] (string | -e string [-e string ...]) names_of_files.gz" << std::endl;
+		std::cout << "  -n  print line numbers" << std::endl;
+		std::cout << "  -m  stop after this many matching lines in each file" << std::endl;
+		return 2;
+	}
+
+	int64_t totalFound = 0;
+	bool failed = false;
+	for (const std::string& fileName : fileNames) {
+		try {
+			EzGz::IGzFile<GrepSettings> input(fileName);
+			totalFound += input.readMatchingLines(searched, [&] (std::span<const char> line, int64_t lineNumber) {
+				if (fileNames.size() > 1) {
+					fputs(fileName.c_str(), stdout);
+					fputc(':', stdout);
+				}
+				if (wantLineNumbers) {
+					printf("%lld:", static_cast<long long>(lineNumber));
+				}
+				fwrite(line.data(), 1, line.size(), stdout);
+				fputc('\n', stdout);
+			}, maxMatches, wantLineNumbers);
+		} catch (std::exception& error) {
+			std::cerr << fileName << ": " << error.what() << std::endl;
+			failed = true;
+		}
+	}
+	return failed ? 2 : (totalFound > 0 ? 0 : 1);
+}
@@ -0,0 +1,38 @@
+//usr/bin/g++ --std=c++20 -Wall $0 -O2 -o ${o=`mktemp`} && exec $o $*
+#include "ezgz.hpp"
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+
+// Rewrites a .gz file with the same repetitions, but split into blocks anew, each with its optimal Huffman codes, without searching for repetitions again
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cout << "Usage: " << argv[0] << " name_of_file_to_recompress.gz name_of_recompressed_file.gz" << std::endl;
+		return 1;
+	}
+
+	std::string inputName = argv[1];
+	std::string outputName = argv[2];
+	ssize_t inputSize = std::filesystem::file_size(inputName);
+
+	std::vector<uint8_t> file(inputSize);
+	std::ifstream input(inputName, std::ios::binary);
+	input.exceptions(std::ifstream::failbit);
+	input.read(reinterpret_cast<char*>(file.data()), file.size());
+	std::ofstream output(outputName, std::ios::binary);
+	output.exceptions(std::ifstream::failbit);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	EzGz::reencodeGzFile(file, [&] (std::span<const uint8_t> written) {
+		output.write(reinterpret_cast<const char*>(written.data()), written.size());
+	});
+	output.close();
+	std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+	std::chrono::microseconds duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
+
+	ssize_t outputSize = std::filesystem::file_size(outputName);
+	std::cout << "Size changed from " << inputSize << " to " << outputSize << " bytes" << std::endl;
+	std::cout << "Recompressed " << inputSize << " bytes at speed " << ((float(inputSize) / (1024 * 1024)) / (float(duration.count()) / 1000000))
+			<< " MiB/s" << std::endl;
+}
@@ -1,5 +1,6 @@
 //usr/bin/g++ --std=c++20 -Wall $0 -g -o ${o=`mktemp`} && exec $o $*
 #include <iostream>
+#include <filesystem>
 #include "ezgz.hpp"
 
 template <int Size>
@@ -13,6 +14,26 @@ struct SettingsWithOutputSize : EzGz::DefaultDecompressionSettings {
 	constexpr static int minOutputBufferSize = MinSize;
 };
 
+struct RuntimeSettings : EzGz::DefaultDecompressionSettings {
+	constexpr static bool runtimeBufferSizes = true;
+};
+
+template <int Threads>
+struct SmallBlockCompressionSettings : EzGz::BestCompressionSettings {
+	constexpr static int blockSize = 20000;
+	constexpr static int compressionThreads = Threads;
+};
+
+template <int Threads>
+struct SmallBlockFastCompressionSettings : EzGz::FastCompressionSettings {
+	constexpr static int blockSize = 20000;
+	constexpr static int compressionThreads = Threads;
+};
+
+struct RsyncableCompressionSettings : EzGz::DefaultCompressionSettings {
+	constexpr static int resetInterval = 4096;
+};
+
 template <int Size>
 struct InputHelper : EzGz::Detail::ByteInput<SettingsWithInputSize<Size>> {
 	InputHelper(std::span<const uint8_t> source)
@@ -25,6 +46,53 @@ struct InputHelper : EzGz::Detail::ByteInput<SettingsWithInputSize<Size>> {
 	}) {}
 };
 
+// The same pseudorandom numbers on every platform, for generating test data
+struct TestRandom {
+	uint32_t seed = 0;
+
+	uint32_t operator()() {
+		seed = seed * 1103515245 + 12345;
+		return seed;
+	}
+};
+
+// Characters chosen randomly from a range, compressible only thanks to their limited variety
+std::string randomCharacters(uint32_t seed, size_t size, char first = 'a', int variants = 26) {
+	TestRandom random{seed};
+	std::string text;
+	while (text.size() < size) {
+		text += char(first + (random() >> 16) % variants);
+	}
+	return text;
+}
+
+// Lines like in logs, a word with a random number and one of two endings, usually chosen to end the line
+std::string randomRecords(uint32_t seed, size_t size, std::string_view word, int numbers, std::string_view ending, std::string_view otherEnding) {
+	TestRandom random{seed};
+	std::string text;
+	while (text.size() < size) {
+		uint32_t number = random();
+		text.append(word).append(" ").append(std::to_string((number >> 8) % numbers)).append((number & 0x100) ? ending : otherEnding);
+	}
+	return text;
+}
+
+// For the callbacks of compressors
+auto appendTo(std::vector<uint8_t>& compressed) {
+	return [&compressed] (std::span<const uint8_t> written) {
+		compressed.insert(compressed.end(), written.begin(), written.end());
+	};
+}
+
+template <typename Output>
+std::vector<uint8_t> compressText(std::string_view text) {
+	std::vector<uint8_t> compressed;
+	Output output(appendTo(compressed));
+	output.write(text);
+	output.finish();
+	return compressed;
+}
+
 int main(int, char**) {
 
 	int errors = 0;
@@ -334,7 +402,7 @@ int main(int, char**) {
 				14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 17, 17, 17, 17, 17,
 				17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 18, 18,
 				18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18};
-		EncodedTable<288, decltype(reader)> table(reader, 270, codeCodingLookup, codeCodingLengths);
+		EncodedTable<288, decltype(reader)> table(reader, 272, codeCodingLookup, codeCodingLengths);
 
 		doATest(table.readWord(), 'R');
 		doATest(table.readWord(), 'A');
@@ -368,6 +436,118 @@ int main(int, char**) {
 		doATest(outputStr, "abaabbbabaababbaababaaaabaaabbbbbaa");
 	}
 
+	{
+		std::cout << "Testing Deflate fixed codes of long lengths" << std::endl;
+		// Lengths 115 and more use 8 bit codes
+		constexpr static std::array<uint8_t, 13> data = { 0x4b, 0x4c, 0x4a, 0x4e, 0x49, 0x4d, 0x4b, 0xcf, 0x48, 0x1c, 0xe2, 0x34, 0x00 };
+		std::vector<char> output = readDeflateIntoVector(data);
+		std::string expected;
+		for (int i = 0; i < 25; i++)
+			expected += "abcdefgh";
+		doATest(std::string_view(output.data(), output.size()), expected);
+	}
+
+	{
+		std::cout << "Testing over-subscribed code length codes" << std::endl;
+		BitWriter writer;
+		writer.putBits(0b101, 3); // Last block, dynamic codes
+		writer.putBits(0, 5); // 257 literal codes
+		writer.putBits(0, 5); // 1 distance code
+		writer.putBits(15, 4); // 19 code length codes
+		for (int i = 0; i < 19; i++) {
+			writer.putBits(1, 3); // More codes of length 1 than possible
+		}
+		writer.putBits(0, 32);
+		writer.alignToByte();
+		std::vector<uint8_t> data = writer.takeCompleteBytes();
+		bool threw = false;
+		try {
+			readDeflateIntoVector(data);
+		} catch (std::runtime_error&) {
+			threw = true;
+		}
+		doATest(threw, true);
+	}
+
+	{
+		std::cout << "Testing code lengths repeated beyond the table" << std::endl;
+		BitWriter writer;
+		writer.putBits(0b101, 3); // Last block, dynamic codes
+		writer.putBits(29, 5); // 286 literal codes
+		writer.putBits(0, 5); // 1 distance code
+		writer.putBits(0, 4); // 4 code length codes, for 16, 17, 18 and 0
+		writer.putBits(0, 3);
+		writer.putBits(0, 3);
+		writer.putBits(1, 3); // 18 is encoded as 1
+		writer.putBits(1, 3); // 0 is encoded as 0
+		for (int i = 0; i < 3; i++) {
+			writer.putBits(1, 1);
+			writer.putBits(127, 7); // 138 zeroes, the third run ends at 414
+		}
+		writer.putBits(0, 32);
+		writer.alignToByte();
+		std::vector<uint8_t> data = writer.takeCompleteBytes();
+		bool threw = false;
+		try {
+			readDeflateIntoVector(data);
+		} catch (std::runtime_error&) {
+			threw = true;
+		}
+		doATest(threw, true);
+	}
+
+	{
+		std::cout << "Testing invalid length and distance symbols" << std::endl;
+		auto putCode = [] (BitWriter& writer, int code, int length) { // Huffman codes start with the most significant bit
+			for (int bit = length - 1; bit >= 0; bit--) {
+				writer.putBits((code >> bit) & 1, 1);
+			}
+		};
+		auto rejected = [] (BitWriter& writer) {
+			writer.putBits(0, 32);
+			writer.alignToByte();
+			std::vector<uint8_t> data = writer.takeCompleteBytes();
+			try {
+				readDeflateIntoVector(data);
+			} catch (std::runtime_error&) {
+				return true;
+			}
+			return false;
+		};
+		BitWriter invalidLength;
+		invalidLength.putBits(0b011, 3); // Last block, fixed codes
+		putCode(invalidLength, 0b00110000 + 'a', 8);
+		putCode(invalidLength, 0b11000000 + (286 - 280), 8); // Length symbol 286 doesn't exist
+		doATest(rejected(invalidLength), true);
+
+		BitWriter invalidDistance;
+		invalidDistance.putBits(0b011, 3);
+		putCode(invalidDistance, 0b00110000 + 'a', 8);
+		putCode(invalidDistance, 0b0000001, 7); // Length 3
+		putCode(invalidDistance, 30, 5); // Distance symbol 30 doesn't exist
+		doATest(rejected(invalidDistance), true);
+	}
+
+	{
+		std::cout << "Testing reading past the end of the input" << std::endl;
+		// Data given after the source reported the end must not be joined to the bits read beyond it, the stream is truncated
+		constexpr static std::array<uint8_t, 11> data = { 0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0x57, 0xc8, 0x40, 0x27, 0xb9, 0x00 };
+		int calls = 0;
+		std::string message;
+		try {
+			readDeflateIntoVector([&calls] (std::span<uint8_t> batch) -> int {
+				calls++;
+				int from = (calls == 1) ? 0 : 1;
+				int size = (calls == 1) ? 1 : (calls == 5) ? std::ssize(data) - 1 : 0;
+				memcpy(batch.data(), data.data() + from, size);
+				return size;
+			});
+		} catch (std::runtime_error& error) {
+			message = error.what();
+		}
+		doATest(message, "Unexpected end of stream");
+	}
+
 	{
 		std::cout << "Testing crc32" << std::endl;
 		constexpr static std::array<uint8_t, 6> data = { 'J', 'e', 'd', 'e', 'n', ' '};
@@ -429,6 +609,1281 @@ int main(int, char**) {
 		}
 	}
 
+	{
+		std::cout << "Testing Zip archive" << std::endl;
+		constexpr static std::array<uint8_t, 262> data = { 0x50, 0x4b, 0x03, 0x04, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60,
+				0xe1, 0x54, 0x8d, 0x83, 0xf7, 0x00, 0x18, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x73,
+				0x74, 0x6f, 0x72, 0x65, 0x64, 0x2e, 0x74, 0x78, 0x74, 0x52, 0x61, 0x77, 0x20, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20,
+				0x6e, 0x6f, 0x20, 0x63, 0x6f, 0x6d, 0x70, 0x72, 0x65, 0x73, 0x73, 0x69, 0x6f, 0x6e, 0x50, 0x4b, 0x03, 0x04, 0x14,
+				0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x60, 0xe1, 0x54, 0x68, 0x02, 0x31, 0x66, 0x0c, 0x00, 0x00, 0x00, 0x1e, 0x00,
+				0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x64, 0x69, 0x72, 0x2f, 0x64, 0x65, 0x66, 0x6c, 0x61, 0x74, 0x65, 0x64, 0x2e,
+				0x74, 0x78, 0x74, 0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0x57, 0xc8, 0xc0, 0x4e, 0x72, 0x01, 0x00, 0x50, 0x4b, 0x01, 0x02,
+				0x14, 0x03, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0xe1, 0x54, 0x8d, 0x83, 0xf7, 0x00, 0x18, 0x00, 0x00,
+				0x00, 0x18, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01,
+				0x00, 0x00, 0x00, 0x00, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x64, 0x2e, 0x74, 0x78, 0x74, 0x50, 0x4b, 0x01, 0x02, 0x14,
+				0x03, 0x14, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x60, 0xe1, 0x54, 0x68, 0x02, 0x31, 0x66, 0x0c, 0x00, 0x00, 0x00,
+				0x1e, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x40,
+				0x00, 0x00, 0x00, 0x64, 0x69, 0x72, 0x2f, 0x64, 0x65, 0x66, 0x6c, 0x61, 0x74, 0x65, 0x64, 0x2e, 0x74, 0x78, 0x74,
+				0x50, 0x4b, 0x05, 0x06, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00, 0x76, 0x00, 0x00, 0x00, 0x7a, 0x00, 0x00,
+				0x00, 0x00, 0x00 };
+		IZipArchive archive(data);
+		doATest(std::ssize(archive.entries()), 2);
+		doATest(archive.entries()[0].name, "stored.txt");
+		doATest(int(archive.entries()[0].compressionMethod), int(ZipCompressionMethod::STORED));
+		doATest(archive.entries()[1].name, "dir/deflated.txt");
+		doATest(archive.entries()[1].uncompressedSize, 30);
+		doATest(archive.find("nonexistent") == nullptr, true);
+
+		IZipEntryContents stored = archive.read(*archive.find("stored.txt"));
+		doATest(std::string_view(stored.data().data(), stored.data().size()), "Raw data, no compression");
+		doATest(stored.isZeroCopy(), true);
+		IZipEntryContents deflated = archive.read(*archive.find("dir/deflated.txt"));
+		doATest(std::string_view(deflated.data().data(), deflated.data().size()), "hello hello hello hello hello\n");
+		doATest(deflated.isZeroCopy(), false);
+
+		std::atomic<int> bytesRead = 0;
+		archive.readAllParallel([&] (const IZipEntryInfo&, std::span<const char> contents) {
+			bytesRead += contents.size();
+		}, 2);
+		doATest(int(bytesRead), 54);
+
+		// A Zip64 record placing the central directory at an offset that would be negative as a signed number
+		std::vector<uint8_t> crafted;
+		appendLittleEndian<uint32_t>(crafted, 0x06064b50);
+		crafted.resize(32);
+		appendLittleEndian<uint64_t>(crafted, 1);
+		appendLittleEndian<uint64_t>(crafted, 16);
+		appendLittleEndian<uint64_t>(crafted, 0xfffffffffffffff8);
+		appendLittleEndian<uint32_t>(crafted, 0x07064b50);
+		appendLittleEndian<uint32_t>(crafted, 0);
+		appendLittleEndian<uint64_t>(crafted, 0);
+		appendLittleEndian<uint32_t>(crafted, 1);
+		appendLittleEndian<uint32_t>(crafted, 0x06054b50);
+		appendLittleEndian<uint32_t>(crafted, 0);
+		appendLittleEndian<uint16_t>(crafted, 0xffff);
+		appendLittleEndian<uint16_t>(crafted, 0xffff);
+		appendLittleEndian<uint32_t>(crafted, 0xffffffff);
+		appendLittleEndian<uint32_t>(crafted, 0xffffffff);
+		appendLittleEndian<uint16_t>(crafted, 0);
+		bool craftedRejected = false;
+		try {
+			IZipArchive craftedArchive(crafted);
+		} catch (std::runtime_error&) {
+			craftedRejected = true;
+		}
+		doATest(craftedRejected, true);
+	}
+
+	{
+		std::cout << "Testing tar.gz parsing" << std::endl;
+		constexpr static std::array<uint8_t, 377> data = {
+				0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xed, 0xd7, 0x4d, 0x4e, 0xc2, 0x40, 0x18, 0x80,
+				0xe1, 0xae, 0x3d, 0x05, 0x5e, 0x00, 0x3a, 0xfd, 0x81, 0x95, 0x89, 0x4b, 0x96, 0xde, 0x80, 0x14, 0x29, 0x60,
+				0x52, 0xa9, 0x81, 0x9a, 0x70, 0x7c, 0x2b, 0x18, 0x0d, 0x68, 0xa2, 0x9b, 0x16, 0x13, 0x9e, 0x77, 0xf3, 0x34,
+				0xdd, 0x34, 0x61, 0xf2, 0xcd, 0x0c, 0xcb, 0xba, 0x5a, 0x94, 0xdb, 0x51, 0xd4, 0x65, 0x71, 0xdb, 0x38, 0xcb,
+				0x0e, 0xb6, 0x9d, 0x7b, 0x78, 0x0e, 0x59, 0x92, 0xe7, 0x21, 0x9e, 0x1c, 0xdf, 0x4f, 0x92, 0x6c, 0x1c, 0x0d,
+				0xf2, 0xa8, 0x87, 0x5e, 0x77, 0x4d, 0xb1, 0x6d, 0x3f, 0x19, 0x5d, 0x67, 0xcb, 0xe3, 0xfa, 0xef, 0xd6, 0xf5,
+				0xb6, 0x19, 0x36, 0xfb, 0xe6, 0x22, 0xeb, 0x1f, 0xd2, 0xd3, 0xf5, 0x0f, 0x21, 0x64, 0x69, 0x34, 0x88, 0xad,
+				0x7f, 0xe7, 0x4d, 0xcb, 0xaa, 0xaa, 0x07, 0xed, 0x4f, 0x70, 0x7b, 0x13, 0xe9, 0xfa, 0x1a, 0x8e, 0x86, 0xa3,
+				0xfb, 0x87, 0x62, 0x3f, 0x2d, 0x8b, 0x76, 0x1f, 0xe8, 0x6e, 0xff, 0xff, 0x61, 0xee, 0x3f, 0xe7, 0x3f, 0x09,
+				0xf9, 0xc9, 0x59, 0x10, 0x87, 0xf6, 0x55, 0x3b, 0xff, 0x7b, 0xf3, 0xdf, 0x79, 0x21, 0x0b, 0x83, 0x97, 0xa2,
+				0x59, 0xdf, 0x7d, 0x1c, 0x04, 0x55, 0xbd, 0x59, 0xcd, 0x36, 0xc5, 0x73, 0x39, 0xeb, 0xf7, 0xe9, 0xfd, 0xec,
+				0xb1, 0x03, 0x5d, 0xec, 0xfc, 0xef, 0x74, 0x89, 0x7f, 0xbf, 0xff, 0x9d, 0x9d, 0xff, 0x69, 0x12, 0xc6, 0x99,
+				0xf3, 0xbf, 0x8f, 0x8a, 0xf9, 0xa3, 0x21, 0xb8, 0xe2, 0xe6, 0x4f, 0xab, 0xae, 0xae, 0xfd, 0x7f, 0xbb, 0xff,
+				0x27, 0x21, 0xcb, 0xbf, 0xff, 0xff, 0x4b, 0xe3, 0xc4, 0xfc, 0xf7, 0x34, 0xff, 0x8b, 0x72, 0xb9, 0x5a, 0x93,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24, 0xc9, 0x2f, 0x23, 0x49, 0x92,
+				0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0xfe, 0x61, 0x6f, 0xd1, 0x53, 0x6f, 0x63, 0x00, 0x40, 0x01, 0x00 };
+		ITarGzFile<SettingsWithOutputSize<32768 * 2 + 258, 32768>> archive(data); // Small batches to split the large entry
+		std::optional<ITarEntryInfo> entry = archive.nextEntry();
+		doATest(entry.has_value(), true);
+		doATest(entry->name, "folder/");
+		doATest(int(entry->type), int(TarEntryType::DIRECTORY));
+		doATest(entry->modificationTime, 1656000000);
+		doATest(archive.readSome().has_value(), false);
+
+		entry = archive.nextEntry();
+		doATest(entry->name, "folder/short.txt");
+		doATest(entry->mode, 0644u);
+		std::vector<char> contents = archive.readEntry();
+		doATest(std::string_view(contents.data(), contents.size()), "Hello tar!\n");
+
+		entry = archive.nextEntry(); // Skipping the contents without reading them
+		doATest(entry->name, "folder/long_name_long_name_long_name_long_name_long_name_long_name_long_name_long_name_long_name_"
+				"long_name_long_name_long_name_.txt");
+
+		entry = archive.nextEntry();
+		doATest(entry->name, "big.txt");
+		doATest(entry->size, 72000);
+		int chunks = 0;
+		int64_t position = 0;
+		archive.readEntry([&] (std::span<const char> chunk) {
+			chunks++;
+			for (char letter : chunk) {
+				if (letter != "abcdefgh"[position % 8])
+					doATest(letter, "abcdefgh"[position % 8]);
+				position++;
+			}
+		});
+		doATest(position, 72000);
+		doATest(chunks > 1, true);
+		doATest(archive.nextEntry().has_value(), false);
+
+		auto makeHeader = [] (std::string_view name, std::string_view magic, char typeFlag, int size, std::string_view atField,
+				std::string_view sizeField = {}) {
+			auto octal = [] (int value, int digits) {
+				std::string written(digits, '0');
+				for (int i = digits - 1; i >= 0; i--, value /= 8) {
+					written[i] = '0' + value % 8;
+				}
+				return written;
+			};
+			std::string header(512, '\0');
+			header.replace(0, name.size(), name);
+			header.replace(124, 11, octal(size, 11));
+			header.replace(124, sizeField.size(), sizeField);
+			header[156] = typeFlag;
+			header.replace(257, magic.size(), magic);
+			header.replace(345, atField.size(), atField);
+			int checksum = ' ' * 8;
+			for (char letter : header) {
+				checksum += uint8_t(letter);
+			}
+			header.replace(148, 7, octal(checksum, 6) + '\0');
+			return header;
+		};
+		auto gzipped = [] (const std::string& tar) {
+			return compressText<OGzFile<>>(tar + std::string(1024, '\0'));
+		};
+		std::vector<uint8_t> gnuTar = gzipped(makeHeader("gnu.txt", std::string_view("ustar  \0", 8), '0', 0, "14712345670"));
+		ITarGzFile<> gnuArchive(gnuTar);
+		doATest(gnuArchive.nextEntry()->name, "gnu.txt"); // Not prefixed by the access time
+
+		auto rejected = [] (const std::vector<uint8_t>& tarGz) {
+			ITarGzFile<> archive(tarGz);
+			try {
+				archive.nextEntry();
+			} catch (std::runtime_error&) {
+				return true;
+			}
+			return false;
+		};
+		auto withPax = [&] (const std::string& records) {
+			return gzipped(makeHeader("pax", std::string_view("ustar\0", 6), 'x', records.size(), "") + records
+					+ std::string(512 - records.size(), '\0') + makeHeader("file.txt", std::string_view("ustar\0", 6), '0', 0, ""));
+		};
+		doATest(rejected(withPax("1234")), true);
+		doATest(rejected(withPax("11 size=-5\n")), true);
+		doATest(rejected(withPax("11 size=5x\n")), true);
+		doATest(rejected(withPax("10 size=5\n")), false);
+		std::string hugeSize(12, '\xff'); // Base-256, more than 63 bits
+		doATest(rejected(gzipped(makeHeader("huge.txt", std::string_view("ustar\0", 6), '0', 0, "", hugeSize))), true);
+	}
+
+	{
+		std::cout << "Testing Huffman code construction" << std::endl;
+		std::array<uint32_t, 30> frequencies = {};
+		frequencies[0] = 1;
+		frequencies[1] = 1;
+		for (int i = 2; i < std::ssize(frequencies); i++) {
+			frequencies[i] = frequencies[i - 1] + frequencies[i - 2]; // Would make codes up to 29 bits long
+		}
+		std::array<uint8_t, 30> lengths = {};
+		buildCodeLengths(frequencies, lengths, 15);
+		double kraftSum = 0;
+		for (uint8_t length : lengths) {
+			kraftSum += 1.0 / (1 << length);
+		}
+		doATest(int(*std::max_element(lengths.begin(), lengths.end())), 15);
+		doATest(kraftSum, 1.0);
+		doATest(lengths[29] <= lengths[0], true);
+
+		std::array<uint16_t, 30> codes = {};
+		lengths = {};
+		lengths[0] = 2;
+		lengths[1] = 1;
+		lengths[2] = 3;
+		lengths[3] = 3;
+		buildCodes(lengths, codes);
+		doATest(codes[1], 0b0);
+		doATest(codes[0], 0b01); // 10 reversed
+		doATest(codes[2], 0b011); // 110 reversed
+		doATest(codes[3], 0b111);
+	}
+
+	{
+		std::cout << "Testing Deflate block writing" << std::endl;
+		std::string text = "hello hello hello hello\n";
+		std::vector<DeflateToken> tokens;
+		for (char letter : std::string_view("hello ")) {
+			tokens.push_back({uint16_t(letter), 0});
+		}
+		tokens.push_back({17, 6});
+		tokens.push_back({'\n', 0});
+		BitWriter writer;
+		writeDeflateBlock(writer, tokens, std::span(reinterpret_cast<const uint8_t*>(text.data()), text.size()), true);
+		writer.alignToByte();
+		std::vector<uint8_t> compressed = writer.takeCompleteBytes();
+		std::vector<char> decompressed = readDeflateIntoVector(compressed);
+		doATest(std::string_view(decompressed.data(), decompressed.size()), text);
+		doATest(compressed.size() < text.size(), true);
+
+		std::string varied;
+		TestRandom random{1};
+		while (varied.size() < 100000) {
+			varied += std::array<std::string_view, 6>{"lorem ", "ipsum ", "dolor ", "sit ", "amet\n", "\x7f\xfe"}[(random() >> 16) % 6];
+		}
+		BitWriter literalWriter;
+		writeLiteralDeflateBlock(literalWriter, std::span(reinterpret_cast<const uint8_t*>(varied.data()), varied.size()));
+		literalWriter.alignToByte();
+		compressed = literalWriter.takeCompleteBytes();
+		decompressed = readDeflateIntoVector(compressed);
+		doATest(std::string_view(decompressed.data(), decompressed.size()), varied);
+		doATest(compressed.size() < varied.size() * 3 / 4, true);
+	}
+
+	{
+		std::cout << "Testing BGZF transcoding" << std::endl;
+		std::string text;
+		for (int i = 0; text.size() < 5000; i++) {
+			text += std::to_string(i * i) + ' ';
+		}
+		std::vector<uint8_t> original;
+		writeBgzfBlock(std::span(reinterpret_cast<const uint8_t*>(text.data()), text.size()), appendTo(original));
+
+		IGzFile<> input(original);
+		std::vector<uint8_t> transcoded;
+		std::vector<GzBlockPosition> positions = transcodeToIndependentBlocks(input, appendTo(transcoded), 1000);
+		doATest(std::ssize(positions), 6);
+		doATest(positions[3].uncompressedOffset, 3000);
+
+		std::vector<GzBlockPosition> loaded = loadGzBlockIndex(saveGzBlockIndex(positions));
+		doATest(std::ssize(loaded), std::ssize(positions));
+		doATest(loaded.back().compressedOffset, positions.back().compressedOffset);
+		for (int i = 0; i < std::ssize(loaded); i++) {
+			IGzFile<> block(std::span<const uint8_t>(transcoded).subspan(loaded[i].compressedOffset));
+			std::vector<char> decompressed = block.readAll();
+			doATest(std::string_view(decompressed.data(), decompressed.size()), std::string_view(text).substr(loaded[i].uncompressedOffset, 1000));
+		}
+	}
+
+	{
+		std::cout << "Testing dictzip random access" << std::endl;
+		constexpr static std::array<uint8_t, 347> data = {
+				0x1f, 0x8b, 0x08, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x18, 0x00, 0x52, 0x41, 0x14, 0x00, 0x01, 0x00,
+				0x40, 0x00, 0x07, 0x00, 0x2d, 0x00, 0x2c, 0x00, 0x2d, 0x00, 0x2f, 0x00, 0x30, 0x00, 0x31, 0x00, 0x14, 0x00,
+				0x64, 0x69, 0x63, 0x74, 0x00, 0x72, 0xcd, 0x2b, 0x29, 0xaa, 0x54, 0x30, 0x30, 0xb0, 0x52, 0x48, 0x49, 0x4d,
+				0xcb, 0xcc, 0xcb, 0x2c, 0xc9, 0xcc, 0xcf, 0x53, 0xc8, 0x4f, 0x53, 0x28, 0xcf, 0x2f, 0x4a, 0x01, 0x0a, 0xeb,
+				0x71, 0xb9, 0x42, 0x14, 0x18, 0x62, 0x57, 0x60, 0x08, 0x00, 0x00, 0x00, 0xff, 0xff, 0xd2, 0xe3, 0x72, 0xcd,
+				0x2b, 0x29, 0xaa, 0x54, 0x30, 0x30, 0xb2, 0x52, 0x48, 0x49, 0x4d, 0xcb, 0xcc, 0xcb, 0x2c, 0xc9, 0xcc, 0xcf,
+				0x53, 0xc8, 0x4f, 0x53, 0x28, 0xcf, 0x2f, 0x4a, 0x01, 0x0a, 0xeb, 0xc1, 0x14, 0x18, 0x63, 0x55, 0x00, 0x00,
+				0x00, 0x00, 0xff, 0xff, 0x32, 0x30, 0xd6, 0xe3, 0x72, 0xcd, 0x2b, 0x29, 0xaa, 0x54, 0x30, 0x30, 0xb1, 0x52,
+				0x48, 0x49, 0x4d, 0xcb, 0xcc, 0xcb, 0x2c, 0xc9, 0xcc, 0xcf, 0x53, 0xc8, 0x4f, 0x53, 0x28, 0xcf, 0x2f, 0x4a,
+				0x01, 0x0a, 0xc3, 0x15, 0x98, 0x62, 0x51, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x4a, 0x51, 0x30, 0x30, 0xd5,
+				0xe3, 0x72, 0xcd, 0x2b, 0x29, 0xaa, 0x54, 0x30, 0x30, 0xb3, 0x52, 0x48, 0x49, 0x4d, 0xcb, 0xcc, 0xcb, 0x2c,
+				0xc9, 0xcc, 0xcf, 0x53, 0xc8, 0x4f, 0x53, 0x28, 0xcf, 0x2f, 0x4a, 0x01, 0x0a, 0xc3, 0x15, 0x98, 0x63, 0x28,
+				0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xca, 0x2f, 0x4a, 0x51, 0x30, 0x30, 0xd7, 0xe3, 0x72, 0xcd, 0x2b, 0x29,
+				0xaa, 0x54, 0x30, 0xb0, 0xb0, 0x52, 0x48, 0x49, 0x4d, 0xcb, 0xcc, 0xcb, 0x2c, 0xc9, 0xcc, 0xcf, 0x53, 0xc8,
+				0x4f, 0x53, 0x28, 0xcf, 0x07, 0x29, 0xb0, 0x80, 0x2b, 0xb0, 0x44, 0x53, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff,
+				0x52, 0x28, 0xcf, 0x2f, 0x4a, 0x51, 0x30, 0xb0, 0xd4, 0xe3, 0x72, 0xcd, 0x2b, 0x29, 0xaa, 0x54, 0x30, 0x34,
+				0xb0, 0x52, 0x48, 0x49, 0x4d, 0xcb, 0xcc, 0xcb, 0x2c, 0xc9, 0xcc, 0xcf, 0x53, 0xc8, 0x4f, 0x53, 0x00, 0x2b,
+				0x30, 0x34, 0x80, 0x2b, 0x30, 0x44, 0x51, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xca, 0x4f, 0x53, 0x28, 0xcf,
+				0x2f, 0x4a, 0x51, 0x30, 0x34, 0xd4, 0xe3, 0x02, 0x00, 0x00, 0x00, 0xff, 0xff, 0x03, 0x00, 0xb2, 0xa2, 0xdc,
+				0x8c, 0x8c, 0x01, 0x00, 0x00 };
+		IGzFile file(data);
+		doATest(file.hasRandomAccess(), true);
+		doATest(file.info().name, "dict");
+		std::vector<char> part = file.readAt(33 * 5 + 10, 21); // Ends in a different chunk than it starts
+		doATest(std::string_view(part.data(), part.size()), "definition of word 05");
+		part = file.readAt(33 * 11, 100); // Goes past the end
+		doATest(std::string_view(part.data(), part.size()), "Entry 11: definition of word 11.\n");
+		std::vector<char> whole = file.readAll();
+		doATest(std::ssize(whole), 33 * 12);
+		doATest(std::string_view(whole.data() + 33 * 2, 33), "Entry 02: definition of word 02.\n");
+
+		bool negativeRejected = false;
+		try {
+			file.readAt(-10, 20);
+		} catch (std::logic_error&) {
+			negativeRejected = true;
+		}
+		doATest(negativeRejected, true);
+
+		std::array<uint8_t, data.size()> emptyChunks = data;
+		emptyChunks[18] = 0; // Chunk length
+		emptyChunks[19] = 0;
+		bool emptyChunksRejected = false;
+		try {
+			IGzFile corrupted(emptyChunks);
+		} catch (std::runtime_error&) {
+			emptyChunksRejected = true;
+		}
+		doATest(emptyChunksRejected, true);
+	}
+
+	{
+		std::cout << "Testing searching for lines" << std::endl;
+		std::string text;
+		for (int i = 0; text.size() < 130000; i++) {
+			text += "line " + std::to_string(i) + ((i % 97 == 0) ? " has a needle" : (i % 101 == 0) ? " has a pin" : " has nothing") + '\n';
+			if (i == 300) {
+				text += "needle in a line longer than the buffer " + std::string(70000, 'x') + '\n';
+			}
+		}
+		text += "unfinished needle";
+		std::vector<uint8_t> compressed = compressText<OGzFile<>>(text);
+		auto expectedLines = [&] (const std::vector<std::string>& searched) {
+			std::vector<std::pair<std::string, int64_t>> expected;
+			std::string_view left = text;
+			for (int64_t lineNumber = 1; !left.empty(); lineNumber++) {
+				std::string_view line = left.substr(0, left.find('\n'));
+				left = left.substr(std::min(line.size() + 1, left.size()));
+				if (std::any_of(searched.begin(), searched.end(), [&] (auto& it) { return line.find(it) != std::string_view::npos; }))
+					expected.emplace_back(line, lineNumber);
+			}
+			return expected;
+		};
+
+		for (const std::vector<std::string>& searched : std::vector<std::vector<std::string>>{{"needle"}, {"needle", "pin"},
+				{"a", "b", "c", "d", "e", "pin"}, {"line 1000 "}, {"missing"}, {""}}) {
+			IGzFile<SettingsWithOutputSize<32768 * 2 + 258, 32768>> file(compressed); // Small batches to split lines
+			std::vector<std::pair<std::string, int64_t>> found;
+			int64_t count = file.readMatchingLines(searched, [&] (std::span<const char> line, int64_t lineNumber) {
+				found.emplace_back(std::string(line.data(), line.size()), lineNumber);
+			}, 0, true);
+			doATest(count, std::ssize(found));
+			doATest(found == expectedLines(searched), true);
+		}
+
+		IGzFile<> file(compressed);
+		std::vector<std::string> found;
+		doATest(file.readMatchingLines({"needle"}, [&] (std::span<const char> line, int64_t lineNumber) {
+			found.emplace_back(line.data(), line.size());
+			doATest(lineNumber, 0);
+		}, 2), 2);
+		doATest(std::ssize(found), 2);
+		doATest(found.back(), "line 97 has a needle");
+	}
+
+	{
+		std::cout << "Testing following a growing file" << std::endl;
+		std::string text;
+		for (int i = 0; i < 2000; i++) {
+			text += "event " + std::to_string(i * i) + '\n';
+		}
+		std::vector<uint8_t> compressed;
+		writeBgzfBlock(std::span(reinterpret_cast<const uint8_t*>(text.data()), text.size()), appendTo(compressed));
+		std::string fileName = (std::filesystem::temp_directory_path() / "ezgz_test_follow.gz").string();
+		auto startWriting = [&] (int initialSize) {
+			std::ofstream(fileName, std::ios::binary).write(reinterpret_cast<const char*>(compressed.data()), initialSize);
+		};
+
+		// The rest of the file is appended one byte at a time, each time the reader waits
+		startWriting(compressed.size() / 2);
+		int written = compressed.size() / 2;
+		int waits = 0;
+		IGzFile<> followed(FollowFile{fileName, std::chrono::milliseconds(0), [&] {
+			waits++;
+			if (written < std::ssize(compressed)) {
+				std::ofstream(fileName, std::ios::binary | std::ios::app).write(reinterpret_cast<const char*>(&compressed[written]), 1);
+				written++;
+			}
+			return true;
+		}});
+		std::string result;
+		followed.readAll([&] (std::span<const char> batch) {
+			result.append(batch.data(), batch.size());
+		});
+		doATest(result == text, true);
+		doATest(waits > std::ssize(compressed) / 3, true);
+
+		startWriting(compressed.size() - 100);
+		bool threw = false;
+		try {
+			IGzFile<> truncated(FollowFile{fileName, std::chrono::milliseconds(0), [] { return false; }});
+			truncated.readAll([] (std::span<const char>) {});
+		} catch (std::runtime_error&) {
+			threw = true;
+		}
+		doATest(threw, true);
+		std::filesystem::remove(fileName);
+	}
+
+	{
+		std::cout << "Testing block boundary observer" << std::endl;
+		std::string first = "abcabcabcabcabcabcabcabc";
+		std::string second = "stored data";
+		std::string third;
+		for (int i = 0; third.size() < 3000; i++) {
+			third += std::to_string(i % 7) + "xyz";
+		}
+		auto asBytes = [] (const std::string& text) {
+			return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+		};
+		std::vector<DeflateToken> tokens = {{'a', 0}, {'b', 0}, {'c', 0}, {21, 3}};
+		BitWriter writer;
+		std::vector<int64_t> blockStarts;
+		blockStarts.push_back(writer.bitsWritten());
+		writeDeflateBlock(writer, tokens, asBytes(first), false);
+		blockStarts.push_back(writer.bitsWritten());
+		writeStoredBlocks(writer, asBytes(second), false);
+		blockStarts.push_back(writer.bitsWritten());
+		std::vector<DeflateToken> literals;
+		for (char letter : third) {
+			literals.push_back({uint8_t(letter), 0});
+		}
+		writeDeflateBlock(writer, literals, asBytes(third), true);
+		writer.alignToByte();
+		std::vector<uint8_t> compressed = writer.takeCompleteBytes();
+
+		IDeflateArchive<> archive(compressed);
+		std::vector<DeflateBlockInfo> blocks;
+		std::string windowAtLast;
+		archive.setBlockObserver([&] (const DeflateBlockInfo& info) {
+			blocks.push_back(info);
+			if (info.last) {
+				windowAtLast = std::string(info.window.data(), info.window.size());
+			}
+		});
+		std::vector<char> decompressed = archive.readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()), first + second + third);
+		doATest(std::ssize(blocks), 3);
+		for (int i = 0; i < std::min<int>(3, blocks.size()); i++) {
+			doATest(blocks[i].compressedBitOffset, blockStarts[i]);
+		}
+		if (blocks.size() == 3) {
+			doATest(blocks[0].type == DeflateBlockType::FIXED, true);
+			doATest(blocks[1].type == DeflateBlockType::STORED, true);
+			doATest(blocks[2].type == DeflateBlockType::DYNAMIC, true);
+			doATest(blocks[1].uncompressedOffset, std::ssize(first));
+			doATest(blocks[2].uncompressedOffset, std::ssize(first + second));
+			doATest(blocks[2].last, true);
+			doATest(windowAtLast, first + second);
+		}
+	}
+
+	{
+		std::cout << "Testing output observers" << std::endl;
+		struct ByteSum {
+			uint64_t sum = 0;
+			void operator() (std::span<const uint8_t> input) {
+				sum = std::accumulate(input.begin(), input.end(), sum);
+			}
+		};
+		struct ObservedSettings : SettingsWithOutputSize<32768 * 2 + 258, 32768> {
+			using Checksum = ChecksumWithObservers<FastCrc32, ByteFrequency, ByteSum>;
+		};
+		std::string text;
+		for (int i = 0; text.size() < 60000; i++) {
+			text += std::to_string(i * 7) + (i % 3 ? ' ' : '\n');
+		}
+		std::vector<uint8_t> compressed;
+		std::span<const uint8_t> textBytes(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+		writeBgzfBlock(textBytes, appendTo(compressed));
+		IGzFile<ObservedSettings> file(compressed);
+		file.readAll([] (std::span<const char>) {});
+		ByteFrequency& frequency = file.checksum().get<ByteFrequency>();
+		doATest(frequency.total(), uint64_t(text.size()));
+		doATest(frequency.counts['\n'], uint64_t(std::count(text.begin(), text.end(), '\n')));
+		doATest(frequency.counts['7'], uint64_t(std::count(text.begin(), text.end(), '7')));
+		doATest(file.checksum().get<ByteSum>().sum, std::accumulate(textBytes.begin(), textBytes.end(), uint64_t(0)));
+		doATest(file.checksum()(), FastCrc32()(textBytes));
+	}
+
+	{
+		std::cout << "Testing runtime buffer sizes" << std::endl;
+		BufferSizes small = BufferSizes::forInputSize(1000, 3000);
+		doATest(small.inputBufferSize, 1024);
+		doATest(small.minOutputBufferSize, 32768);
+		doATest(small.maxOutputBufferSize, 32768 + 4096);
+		BufferSizes large = BufferSizes::forInputSize(50'000'000'000);
+		doATest(large.inputBufferSize, 1 << 20);
+		doATest(large.maxOutputBufferSize, 32768 + (1 << 23));
+
+		std::string text;
+		for (int i = 0; text.size() < 60000; i++) {
+			text += std::to_string(i * 13) + ',';
+		}
+		std::vector<uint8_t> compressed;
+		writeBgzfBlock(std::span(reinterpret_cast<const uint8_t*>(text.data()), text.size()), appendTo(compressed));
+		IGzFile<RuntimeSettings> tuned(compressed);
+		int batches = 0;
+		std::string decompressed;
+		tuned.readAll([&] (std::span<const char> batch) {
+			decompressed.append(batch.data(), batch.size());
+			batches++;
+		});
+		doATest(decompressed, text);
+		doATest(batches, 1);
+
+		IGzFile<RuntimeSettings> tiny(compressed, BufferSizes{32768 + 1000, 32768, 64});
+		decompressed.clear();
+		tiny.readAll([&] (std::span<const char> batch) {
+			decompressed.append(batch.data(), batch.size());
+		});
+		doATest(decompressed, text);
+
+		bool threw = false;
+		try {
+			IGzFile<> fixed(compressed, BufferSizes{32768 + 1000, 32768, 64});
+		} catch (std::logic_error&) {
+			threw = true;
+		}
+		doATest(threw, true);
+	}
+
+	{
+		std::cout << "Testing low latency decompression" << std::endl;
+		std::string first;
+		std::string second;
+		for (int i = 0; first.size() < 5000; i++) {
+			first += "request " + std::to_string(i) + '\n';
+			second += "response " + std::to_string(i) + '\n';
+		}
+		auto writeLiterals = [] (BitWriter& writer, const std::string& text, bool last) {
+			std::vector<DeflateToken> tokens;
+			for (char letter : text) {
+				tokens.push_back({uint8_t(letter), 0});
+			}
+			writeDeflateBlock(writer, tokens, std::span(reinterpret_cast<const uint8_t*>(text.data()), text.size()), last);
+		};
+		BitWriter writer;
+		writeLiterals(writer, first, false);
+		writeStoredBlocks(writer, {}, false); // Like a sync flush
+		int flushPoint = writer.bitsWritten() / 8;
+		writeLiterals(writer, second, true);
+		writer.alignToByte();
+		std::vector<uint8_t> compressed = writer.takeCompleteBytes();
+
+		{
+			IDeflateArchive<> archive(compressed);
+			archive.setLowLatency(1000);
+			std::string result;
+			bool smallBatches = true;
+			while (std::optional<std::span<const char>> batch = archive.readSome()) {
+				result.append(batch->data(), batch->size());
+				smallBatches = smallBatches && batch->size() <= 1000;
+			}
+			doATest(result, first + second);
+			doATest(smallBatches, true);
+		}
+
+		int delivered = 0;
+		int deliverable = flushPoint;
+		std::string result;
+		int64_t decompressedBeforeWaiting = -1;
+		IDeflateArchive<> archive([&] (std::span<uint8_t> batch) {
+			int giving = std::min<int>(batch.size(), deliverable - delivered);
+			memcpy(batch.data(), &compressed[delivered], giving);
+			delivered += giving;
+			return giving;
+		}, [&] {
+			if (decompressedBeforeWaiting < 0)
+				decompressedBeforeWaiting = result.size();
+			bool more = deliverable < std::ssize(compressed);
+			deliverable = compressed.size();
+			return more;
+		});
+		archive.setLowLatency(1 << 20);
+		while (std::optional<std::span<const char>> batch = archive.readSome()) {
+			result.append(batch->data(), batch->size());
+		}
+		doATest(result, first + second);
+		doATest(decompressedBeforeWaiting, std::ssize(first));
+	}
+
+	{
+		std::cout << "Testing format detection" << std::endl;
+		doATest(Adler32()(std::span(reinterpret_cast<const uint8_t*>("Wikipedia"), 9)), 0x11e60398u);
+
+		std::string text;
+		for (int i = 0; text.size() < 20000; i++) {
+			text += "Record number " + std::to_string(i) + '\n';
+		}
+		std::span<const uint8_t> textBytes(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+		std::vector<uint8_t> gzipped;
+		writeBgzfBlock(textBytes, appendTo(gzipped));
+		BitWriter writer;
+		writeLiteralDeflateBlock(writer, textBytes);
+		writer.alignToByte();
+		std::vector<uint8_t> deflated = writer.takeCompleteBytes();
+		std::vector<uint8_t> zlibbed = {0x78, 0x01};
+		zlibbed.insert(zlibbed.end(), deflated.begin(), deflated.end());
+		uint32_t adler = Adler32()(textBytes);
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			zlibbed.push_back(uint8_t(adler >> shift));
+		}
+		std::vector<uint8_t> plain(textBytes.begin(), textBytes.end());
+
+		for (auto [data, format] : std::vector<std::pair<std::span<const uint8_t>, CompressionFormat>>{{gzipped, CompressionFormat::GZIP},
+				{zlibbed, CompressionFormat::ZLIB}, {deflated, CompressionFormat::DEFLATE}, {plain, CompressionFormat::NONE}}) {
+			IAutoFile<> fromMemory(data);
+			doATest(fromMemory.format() == format, true);
+			std::vector<char> decompressed = fromMemory.readAll();
+			doATest(std::string_view(decompressed.data(), decompressed.size()), text);
+
+			IAutoStream stream([data = data] (std::span<uint8_t> batch) mutable -> int {
+				int copying = std::min<int>({int(batch.size()), int(data.size()), 1000});
+				memcpy(batch.data(), data.data(), copying);
+				data = data.subspan(copying);
+				return copying;
+			});
+			doATest(stream.format() == format, true);
+			std::string line;
+			int lines = 0;
+			bool correct = true;
+			while (std::getline(stream, line)) {
+				correct = correct && line == "Record number " + std::to_string(lines);
+				lines++;
+			}
+			doATest(correct, true);
+			doATest(lines, int(std::count(text.begin(), text.end(), '\n')));
+		}
+
+		IAutoFile<> plainFile(plain);
+		std::optional<std::span<const char>> batch = plainFile.readSome();
+		doATest(batch.has_value() && reinterpret_cast<const uint8_t*>(batch->data()) == plain.data(), true); // Not copied
+		std::string_view shortText = "hi";
+		doATest(detectCompressionFormat(std::span(reinterpret_cast<const uint8_t*>(shortText.data()), shortText.size()), true) == CompressionFormat::NONE, true);
+
+		// Garbage must be rejected by the trial decoding rather than break it
+		std::vector<uint8_t> noise(5000);
+		TestRandom random{12345};
+		int detectedNoise = 0;
+		for (int attempt = 0; attempt < 200; attempt++) {
+			for (uint8_t& byte : noise) {
+				byte = uint8_t(random() >> 23);
+			}
+			detectedNoise += (detectCompressionFormat(noise, true) != CompressionFormat::NONE);
+		}
+		doATest(detectedNoise, 0);
+	}
+
+	{
+		std::cout << "Testing reading multiple files" << std::endl;
+		std::string text;
+		std::vector<std::vector<uint8_t>> files;
+		size_t firstSize = 0;
+		for (int file = 0; file < 4; file++) {
+			std::string part;
+			for (int i = 0; part.size() < size_t(1000 + file * 15000); i++) {
+				part += "File " + std::to_string(file) + " line " + std::to_string(i) + '\n';
+			}
+			part.resize(part.size() - 3 * file); // Lines continue in the next file
+			text += part;
+			firstSize = file == 0 ? part.size() : firstSize;
+			files.emplace_back();
+			writeBgzfBlock(std::span(reinterpret_cast<const uint8_t*>(part.data()), part.size()), appendTo(files.back()));
+		}
+		auto makeSources = [&files] {
+			std::vector<std::function<int(std::span<uint8_t>)>> sources;
+			for (std::span<const uint8_t> data : files) {
+				sources.push_back([data] (std::span<uint8_t> batch) mutable -> int {
+					int copying = std::min<int>(batch.size(), data.size());
+					memcpy(batch.data(), data.data(), copying);
+					data = data.subspan(copying);
+					return copying;
+				});
+			}
+			return sources;
+		};
+
+		std::vector<char> all = IGzMultiFile<>(makeSources()).readAll();
+		doATest(std::string_view(all.data(), all.size()), text);
+
+		IGzMultiFile<> byLines(makeSources());
+		std::string joined;
+		byLines.readByLines([&] (std::span<const char> line) {
+			joined.append(line.data(), line.size());
+			joined += '\n';
+		});
+		doATest(joined, text + '\n'); // The last line has no separator
+
+		IGzMultiStream stream(makeSources(), 20);
+		std::string streamed;
+		char letter = 0;
+		int ungotten = 0;
+		while (stream.get(letter)) {
+			streamed += letter;
+			if (streamed.size() == firstSize + 1 && ungotten == 0) { // Reaching the second file
+				doATest(stream.fileIndex(), 1);
+				for (int i = 0; i < 15; i++) {
+					stream.unget();
+					streamed.pop_back();
+				}
+				ungotten++;
+			}
+		}
+		doATest(streamed == text, true);
+		doATest(stream.fileIndex(), 4);
+	}
+
+	{
+		std::cout << "Testing small memory profile" << std::endl;
+		doATest(sizeof(IGzFile<SmallDecompressionSettings>) < 40000, true);
+		doATest(sizeof(Detail::DeflateReader<SmallDecompressionSettings>) < 4000, true);
+
+		// Copies from up to 32 kiB back, often across the end of the ring buffer
+		std::string text;
+		std::vector<DeflateToken> tokens;
+		TestRandom random{7};
+		while (text.size() < 300000) {
+			uint32_t seed = random();
+			int distance = 1 + (seed >> 8) % 32768;
+			int length = 3 + (seed >> 3) % 256;
+			if (distance <= std::ssize(text) && (seed & 0x3)) {
+				for (int i = 0; i < length; i++) {
+					text += text[text.size() - distance];
+				}
+				tokens.push_back({uint16_t(length), uint16_t(distance)});
+			} else {
+				char letter = 'a' + (seed >> 20) % 26;
+				text += letter;
+				tokens.push_back({uint16_t(letter), 0});
+			}
+		}
+		BitWriter writer;
+		writeDeflateBlock(writer, tokens, {}, true);
+		writer.alignToByte();
+		std::vector<uint8_t> compressed = writer.takeCompleteBytes();
+		std::vector<char> decompressed = readDeflateIntoVector<SmallDecompressionSettings>(compressed);
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+
+		IDeflateArchive<SmallDecompressionSettings> archive(compressed);
+		std::string joined;
+		bool keptCorrect = true;
+		while (std::optional<std::span<const char>> batch = archive.readSome(100)) {
+			if (joined.size() >= 100) {
+				keptCorrect = keptCorrect && std::string_view(batch->data() - 100, 100) == std::string_view(joined).substr(joined.size() - 100);
+			}
+			joined.append(batch->data(), batch->size());
+		}
+		doATest(joined == text, true);
+		doATest(keptCorrect, true);
+	}
+
+	{
+		std::cout << "Testing compression" << std::endl;
+		std::string text = randomCharacters(3, 20000); // Fits into the window
+		std::vector<uint8_t> compressed;
+		OGzFile<> output(appendTo(compressed));
+		output.write(text);
+		output.flush();
+		size_t firstPart = compressed.size();
+		doATest(firstPart < text.size() * 2 / 3, true); // Only the letters can be compressed
+		doATest(compressed[firstPart - 2] == 0xff && compressed[firstPart - 1] == 0xff, true); // Ends with an empty stored block
+		output.write(text); // Refers to the first part
+		output.finish();
+		doATest(compressed.size() - firstPart < firstPart / 10, true);
+		std::vector<char> decompressed = IGzFile<>(compressed).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text + text, true);
+
+		std::stringstream stream;
+		{
+			OGzStream compressing(stream);
+			for (int i = 0; i < 10000; i++) {
+				compressing << "Message " << i << '\n';
+				if (i % 1000 == 0) {
+					compressing << std::flush;
+				}
+			}
+		}
+		IGzStream decompressing(stream);
+		std::string line;
+		int lines = 0;
+		bool correct = true;
+		while (std::getline(decompressing, line)) {
+			correct = correct && line == "Message " + std::to_string(lines);
+			lines++;
+		}
+		doATest(correct, true);
+		doATest(lines, 10000);
+	}
+
+	{
+		std::cout << "Testing fast compression" << std::endl;
+		std::string text = randomRecords(7, 500000, "Event", 1000, " processed\n", " failed\n");
+		auto compress = [&] <typename Settings> (Settings) {
+			std::vector<uint8_t> compressed;
+			OGzFile<Settings> output(appendTo(compressed));
+			output.write(std::span<const char>(text).subspan(0, text.size() / 2));
+			output.flush();
+			output.write(std::span<const char>(text).subspan(text.size() / 2));
+			output.finish();
+			return compressed;
+		};
+		std::vector<uint8_t> fast = compress(FastCompressionSettings{});
+		std::vector<uint8_t> normal = compress(DefaultCompressionSettings{});
+		std::vector<char> decompressed = IGzFile<>(fast).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(fast.size() < text.size() / 3, true);
+		doATest(fast.size() >= normal.size(), true);
+		doATest(compress(SmallBlockFastCompressionSettings<1>{}) == compress(SmallBlockFastCompressionSettings<4>{}), true);
+	}
+
+	{
+		std::cout << "Testing best compression" << std::endl;
+		std::string text = randomRecords(11, 100000, "Event", 1000, " processed\n", " failed\n")
+				+ randomCharacters(11, 30000, '0', 10); // Different statistics, should get another block
+		auto compress = [&] <typename Settings> (Settings) {
+			return compressText<OGzFile<Settings>>(text);
+		};
+		std::vector<uint8_t> best = compress(BestCompressionSettings{});
+		std::vector<uint8_t> normal = compress(DefaultCompressionSettings{});
+		std::vector<char> decompressed = IGzFile<>(best).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(best.size() < normal.size(), true);
+		std::vector<uint8_t> singleThread = compress(SmallBlockCompressionSettings<1>{});
+		decompressed = IGzFile<>(singleThread).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(compress(SmallBlockCompressionSettings<3>{}) == singleThread, true);
+	}
+
+	{
+		std::cout << "Testing rsyncable compression" << std::endl;
+		std::string text = randomRecords(5, 320000, "Entry", 10000, " added\n", " removed\n");
+		auto compress = [] (const std::string& text, std::vector<GzBlockPosition>* resets = nullptr) {
+			std::vector<uint8_t> compressed;
+			OGzFile<RsyncableCompressionSettings> output(appendTo(compressed));
+			output.write(text);
+			output.finish();
+			if (resets) {
+				*resets = output.resetPositions();
+			}
+			return compressed;
+		};
+		std::vector<GzBlockPosition> resets;
+		std::vector<uint8_t> original = compress(text, &resets);
+		std::vector<char> decompressed = IGzFile<>(original).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(resets.size() > 10 && resets.size() < 200, true);
+
+		// Decompression from a reset point needs no earlier data
+		GzBlockPosition middle = resets[resets.size() / 2];
+		decompressed = IDeflateArchive<>(std::span<const uint8_t>(original).subspan(middle.compressedOffset)).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == std::string_view(text).substr(middle.uncompressedOffset), true);
+
+		// A change affects the output only until the next reset point, the trailer differs too
+		std::string changed = text;
+		changed[1000] = '#';
+		std::vector<uint8_t> changedCompressed = compress(changed);
+		auto [originalDifference, changedDifference] = std::mismatch(original.rbegin() + 8, original.rend(), changedCompressed.rbegin() + 8, changedCompressed.rend());
+		doATest(original.rend() - originalDifference < resets[2].compressedOffset, true);
+	}
+
+	{
+		std::cout << "Testing compression with a dictionary" << std::endl;
+		TestRandom random{13};
+		auto makeMessage = [&random] () {
+			uint32_t seed = random();
+			return "{\"type\":\"" + std::string((seed >> 16) % 2 ? "click" : "view") + "\",\"user\":" + std::to_string((seed >> 8) % 100000)
+					+ ",\"page\":\"/products/" + std::to_string((seed >> 4) % 500) + "\",\"client\":{\"browser\":\"Firefox\",\"language\":\"en-GB\"}}";
+		};
+		std::vector<std::string> samples;
+		for (int i = 0; i < 1000; i++) {
+			samples.push_back(makeMessage());
+		}
+		std::vector<char> dictionary = buildDeflateDictionary(samples, 4096);
+		doATest(dictionary.size() > 50 && dictionary.size() <= 4096, true);
+
+		std::string message = makeMessage();
+		auto compress = [&] (std::span<const char> usedDictionary) {
+			std::vector<uint8_t> compressed;
+			ODeflateArchive<> output(appendTo(compressed), usedDictionary);
+			output.write(message);
+			output.finish();
+			return compressed;
+		};
+		std::vector<uint8_t> withDictionary = compress(dictionary);
+		doATest(withDictionary.size() < compress({}).size() / 2, true);
+		std::vector<char> decompressed = readDeflateIntoVector(withDictionary, dictionary);
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == message, true);
+
+		std::vector<uint8_t> fastWithDictionary;
+		{
+			ODeflateArchive<FastCompressionSettings> output(appendTo(fastWithDictionary), dictionary);
+			output.write(message);
+			output.finish();
+		}
+		doATest(fastWithDictionary.size() < compress({}).size() / 2, true);
+		decompressed = readDeflateIntoVector(fastWithDictionary, dictionary);
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == message, true);
+
+		DeflateMessageReader<> reader(dictionary);
+		bool allCorrect = true;
+		for (int i = 0; i < 100; i++) {
+			message = makeMessage();
+			withDictionary = compress(dictionary);
+			reader.read(withDictionary, decompressed);
+			allCorrect = allCorrect && std::string_view(decompressed.data(), decompressed.size()) == message;
+		}
+		doATest(allCorrect, true);
+
+		std::vector<uint8_t> zlibCompressed;
+		{
+			OZlibFile<> output(appendTo(zlibCompressed), dictionary);
+			output.write(message);
+			output.finish();
+		}
+		IZlibFile<> needingDictionary(zlibCompressed);
+		doATest(needingDictionary.requiredDictionary().has_value(), true);
+		bool thrown = false;
+		try {
+			needingDictionary.readAll();
+		} catch (std::runtime_error&) {
+			thrown = true;
+		}
+		doATest(thrown, true);
+		IZlibFile<> zlibFile(zlibCompressed);
+		zlibFile.setDictionary(dictionary);
+		decompressed = zlibFile.readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == message, true);
+	}
+
+	{
+		std::cout << "Testing saving decompression state" << std::endl;
+		std::string text;
+		TestRandom random{17};
+		while (text.size() < 300000) {
+			uint32_t seed = random();
+			int distance = 1 + (seed >> 8) % 32768;
+			if (distance <= std::ssize(text) && (seed & 0x3)) {
+				text += text.substr(text.size() - distance, 3 + (seed >> 3) % 100);
+			} else {
+				text += char('a' + (seed >> 20) % 26);
+			}
+		}
+		std::vector<uint8_t> compressed = compressText<OGzFile<>>(text);
+
+		auto continueFromMiddle = [&] <typename Settings> (IGzFile<Settings>& first) {
+			std::string joined;
+			while (joined.size() < text.size() / 2) {
+				std::span<const char> batch = *first.readSome();
+				joined.append(batch.data(), batch.size());
+			}
+			std::vector<uint8_t> saved = first.saveState();
+			IGzFile<Settings> second(compressed);
+			second.restoreState(saved);
+			std::vector<char> rest = second.readAll(); // Also verifies the checksum
+			return joined + std::string(rest.data(), rest.size()) == text && saved.size() < 34000;
+		};
+		IGzFile<> linear(compressed);
+		linear.setLowLatency(10000);
+		doATest(continueFromMiddle(linear), true);
+		IGzFile<SmallDecompressionSettings> circular(compressed);
+		doATest(continueFromMiddle(circular), true);
+
+		bool thrown = false;
+		try {
+			IGzFile<> started(compressed);
+			started.readSome();
+			started.restoreState(linear.saveState());
+		} catch (std::logic_error&) {
+			thrown = true;
+		}
+		doATest(thrown, true);
+	}
+
+	{
+		std::cout << "Testing parallel decompression with an index" << std::endl;
+		std::string text = randomRecords(19, 1000000, "Line", 5000, " was seen\n", " was not seen\n");
+		std::vector<uint8_t> compressed = compressText<OGzFile<>>(text);
+		DeflateIndex built;
+		IGzFile<SmallDecompressionSettings> indexed(compressed);
+		indexed.setBlockObserver(built.observer(100000));
+		indexed.readAll([] (std::span<const char>) {});
+		doATest(built.checkpoints.size() >= 5, true);
+		DeflateIndex index = DeflateIndex::load(built.save());
+		doATest(index.checkpoints.size(), built.checkpoints.size());
+
+		ParallelDeflateReader<> reader(compressed, index, 3);
+		std::vector<char> decompressed = reader.readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(reader.checksum()(), Detail::readLittleEndian<uint32_t>(compressed, compressed.size() - 8));
+
+		auto rejected = [&index] (std::span<const uint8_t> file) {
+			try {
+				ParallelDeflateReader<>(file, index, 3).readAll();
+			} catch (std::runtime_error&) {
+				return true;
+			}
+			return false;
+		};
+		std::vector<uint8_t> corrupted = compressed;
+		corrupted[corrupted.size() - 8] ^= 1;
+		doATest(rejected(corrupted), true);
+		corrupted = compressed;
+		corrupted[corrupted.size() - 4] ^= 1;
+		doATest(rejected(corrupted), true);
+		doATest(rejected(std::span<const uint8_t>(compressed).first(compressed.size() - 3)), true);
+
+		ParallelDeflateReader<> lineReader(compressed, index, 2);
+		int64_t lines = 0;
+		bool linesCorrect = true;
+		lineReader.readByLines([&] (std::span<const char> line) {
+			if (!line.empty()) { // The separator at the end is followed by an empty line
+				linesCorrect = linesCorrect && std::string_view(line.data(), line.size()).starts_with("Line ");
+				lines++;
+			}
+		});
+		doATest(linesCorrect, true);
+		doATest(lines, std::count(text.begin(), text.end(), '\n'));
+	}
+
+	{
+		std::cout << "Testing joining compressed files" << std::endl;
+		std::vector<std::string> texts = {"The first file\n", randomCharacters(23, 200000), std::string(100000, 'x'), "The last file\n"};
+		std::vector<std::vector<uint8_t>> gzFiles;
+		std::vector<std::vector<uint8_t>> zlibStreams;
+		for (const std::string& text : texts) {
+			gzFiles.push_back(compressText<OGzFile<>>(text));
+			zlibStreams.push_back(compressText<OZlibFile<>>(text));
+		}
+		auto join = [] (const std::vector<std::vector<uint8_t>>& parts, auto joinFunction) {
+			std::vector<std::span<const uint8_t>> spans(parts.begin(), parts.end());
+			std::vector<uint8_t> joined;
+			joinFunction(spans, appendTo(joined));
+			return joined;
+		};
+		std::string allTexts = texts[0] + texts[1] + texts[2] + texts[3];
+		std::vector<uint8_t> joinedGz = join(gzFiles, joinGzFiles);
+		std::vector<char> decompressed = IGzFile<>(joinedGz).readAll(); // Verifies the combined checksum
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == allTexts, true);
+		std::vector<uint8_t> joinedZlib = join(zlibStreams, joinZlibStreams);
+		decompressed = IZlibFile<>(joinedZlib).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == allTexts, true);
+
+		std::span<const uint8_t> first(reinterpret_cast<const uint8_t*>(texts[0].data()), texts[0].size());
+		std::span<const uint8_t> second(reinterpret_cast<const uint8_t*>(texts[1].data()), texts[1].size());
+		FastCrc32 crc;
+		crc(first);
+		doATest(FastCrc32::combine(FastCrc32()(first), FastCrc32()(second), second.size()), crc(second));
+	}
+
+	{
+		std::cout << "Testing extracting a range of a compressed file" << std::endl;
+		std::string text;
+		TestRandom random{29};
+		while (text.size() < 1000000) {
+			text += "Event " + std::to_string((random() >> 8) % 100000) + " at " + std::to_string(text.size()) + "\n";
+		}
+		std::vector<uint8_t> compressed = compressText<OGzFile<>>(text);
+		bool allCorrect = true;
+		for (auto [offset, length] : std::vector<std::pair<int64_t, int64_t>>{{0, 10}, {123456, 500000}, {300000, 2000000}, {2000000, 10}}) {
+			std::vector<uint8_t> extracted;
+			extractGzRange(compressed, offset, length, appendTo(extracted));
+			std::vector<char> decompressed = IGzFile<>(extracted).readAll();
+			std::string expected = offset < std::ssize(text) ? text.substr(offset, length) : "";
+			allCorrect = allCorrect && std::string_view(decompressed.data(), decompressed.size()) == expected;
+		}
+		doATest(allCorrect, true);
+
+		std::vector<uint8_t> whole;
+		extractGzRange(compressed, 0, text.size(), appendTo(whole));
+		doATest(whole.size() < compressed.size() * 101 / 100, true); // Most blocks are copied
+	}
+
+	{
+		std::cout << "Testing extracting a range with stored blocks and flushes" << std::endl;
+		std::string text;
+		std::vector<uint8_t> compressed;
+		OGzFile<> output(appendTo(compressed));
+		for (uint32_t part = 0; text.size() < 600000; part++) {
+			// Random bytes are stored without compression, flushes leave empty stored blocks at various bit positions
+			std::string added = (part % 2) ? randomCharacters(37 + part, 5000 + part * 997, 0, 256) : randomRecords(37 + part, 20000 + part * 331, "Flushed", 500, "\n", " ");
+			text += added;
+			output.write(added);
+			output.flush();
+		}
+		output.finish();
+
+		bool allCorrect = true;
+		for (auto [offset, length] : std::vector<std::pair<int64_t, int64_t>>{{0, int64_t(text.size())}, {3, 400000}, {50000, 300001}, {12345, 1000000}}) {
+			std::vector<uint8_t> extracted;
+			extractGzRange(compressed, offset, length, appendTo(extracted));
+			std::vector<char> decompressed = IGzFile<>(extracted).readAll();
+			allCorrect = allCorrect && std::string_view(decompressed.data(), decompressed.size()) == text.substr(offset, length);
+		}
+		doATest(allCorrect, true);
+
+		bool rejected = false;
+		try {
+			extractGzRange(compressed, -1, 10, appendTo(compressed));
+		} catch (std::logic_error&) {
+			rejected = true;
+		}
+		doATest(rejected, true);
+	}
+
+	{
+		std::cout << "Testing reading tokens" << std::endl;
+		std::string text = randomRecords(31, 300000, "Token", 3000, "\n", " ");
+		std::vector<uint8_t> compressed;
+		{
+			ODeflateArchive<> output(appendTo(compressed));
+			output.write(std::string_view(text).substr(0, 1000));
+			output.flush(); // Adds an empty stored block
+			output.write(std::string_view(text).substr(1000));
+			output.finish();
+		}
+
+		DeflateTokenReader<> reader(compressed);
+		std::string restored;
+		int blocks = 0;
+		int emptyBlocks = 0;
+		int repetitions = 0;
+		bool boundariesCorrect = true;
+		int64_t blockBitOffset = -1;
+		while (std::optional<std::span<const DeflateToken>> tokens = reader.readSome()) {
+			const DeflateBlockInfo& block = reader.currentBlock();
+			if (block.compressedBitOffset != blockBitOffset) { // A new block starts where the previous one ended
+				blockBitOffset = block.compressedBitOffset;
+				blocks++;
+				emptyBlocks += tokens->empty();
+				boundariesCorrect = boundariesCorrect && block.uncompressedOffset == std::ssize(restored)
+						&& (block.type == DeflateBlockType::STORED) == block.literalCodeLengths.empty();
+			}
+			for (DeflateToken token : *tokens) {
+				if (token.distance == 0) {
+					restored += char(token.lengthOrLiteral);
+				} else {
+					repetitions++;
+					for (int i = 0; i < token.lengthOrLiteral; i++) {
+						restored += restored[restored.size() - token.distance];
+					}
+				}
+			}
+		}
+		doATest(restored == text, true);
+		doATest(reader.uncompressedPosition(), int64_t(text.size()));
+		doATest(boundariesCorrect, true);
+		doATest(blocks >= 4, true);
+		doATest(emptyBlocks, 1);
+		doATest(repetitions > 10000, true);
+	}
+
+	{
+		std::cout << "Testing recompressing with new codes" << std::endl;
+		std::string text = randomRecords(37, 300000, "Entry", 5000, "\n", " ");
+		auto compressInPieces = [&text] <typename Output> () {
+			std::vector<uint8_t> compressed;
+			Output output(appendTo(compressed));
+			for (size_t position = 0; position < text.size(); position += 300) {
+				output.write(std::string_view(text).substr(position, 300));
+				output.flush(); // Many small blocks, mostly with fixed codes
+			}
+			output.finish();
+			return compressed;
+		};
+		auto reencode = [] (std::span<const uint8_t> compressed, auto reencodeFunction) {
+			std::vector<uint8_t> reencoded;
+			reencodeFunction(compressed, appendTo(reencoded));
+			return reencoded;
+		};
+
+		std::vector<uint8_t> gz = compressInPieces.template operator()<OGzFile<>>();
+		std::vector<uint8_t> reencodedGz = reencode(gz, reencodeGzFile);
+		std::vector<char> decompressed = IGzFile<>(reencodedGz).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(reencodedGz.size() < gz.size() * 3 / 4, true);
+
+		std::vector<uint8_t> deflate = compressInPieces.template operator()<ODeflateArchive<>>();
+		std::vector<uint8_t> reencodedDeflate = reencode(deflate, reencodeDeflate);
+		decompressed = IDeflateArchive<>(reencodedDeflate).readAll();
+		doATest(std::string_view(decompressed.data(), decompressed.size()) == text, true);
+		doATest(reencodedDeflate.size() + 18 == reencodedGz.size(), true);
+
+		auto rejected = [&] (std::span<const uint8_t> file) {
+			try {
+				reencode(file, reencodeGzFile);
+			} catch (std::runtime_error&) {
+				return true;
+			}
+			return false;
+		};
+		doATest(rejected(std::span<const uint8_t>(gz).first(gz.size() - 3)), true);
+		std::vector<uint8_t> wrongSize = gz;
+		wrongSize[wrongSize.size() - 4] ^= 1;
+		doATest(rejected(wrongSize), true);
+		doATest([&] {
+			try {
+				IGzFile<>(wrongSize).readAll();
+			} catch (std::runtime_error&) {
+				return true;
+			}
+			return false;
+		}(), true);
+		gz[gz.size() - 8] ^= 1;
+		doATest(rejected(gz), true);
+	}
+
+	{
+		std::cout << "Testing truncated stored block" << std::endl;
+		std::string noise = randomCharacters(41, 200000, 0, 256);
+		std::vector<uint8_t> compressed;
+		OGzFile<> output(appendTo(compressed));
+		output.write(noise); // Incompressible, so it's written in stored blocks
+		output.finish();
+		compressed.resize(100000);
+		bool truncationFound = false;
+		try {
+			IGzFile<>(compressed).readAll();
+		} catch (std::runtime_error&) {
+			truncationFound = true;
+		}
+		doATest(truncationFound, true);
+	}
+
+	{
+		std::cout << "Testing code lengths continuing into the distance table" << std::endl;
+		// A dynamic block with 258 literal codes and 3 distance codes, a run of zero lengths covers the last literal and two distances
+		auto makeBlock = [] (int zeroesAfterEnd) {
+			BitWriter writer;
+			writer.putBits(1, 1); // Last block
+			writer.putBits(2, 2); // Dynamic codes
+			writer.putBits(258 - 257, 5);
+			writer.putBits(3 - 1, 5);
+			writer.putBits(18 - 4, 4);
+			for (int i = 0; i < 18; i++) {
+				int symbol = codeCodingReorder[i];
+				writer.putBits((symbol == 0 || symbol == 1 || symbol == 17 || symbol == 18) ? 2 : 0, 3);
+			}
+			// Codes of 2 bits for 0, 1, 17 and 18, reversed because they're read from the highest bit
+			auto putLength = [&] (int symbol) {
+				writer.putBits(symbol == 0 ? 0b00 : symbol == 1 ? 0b10 : symbol == 17 ? 0b01 : 0b11, 2);
+			};
+			putLength(18);
+			writer.putBits(97 - 11, 7); // Zeroes before 'a'
+			putLength(1);
+			putLength(18);
+			writer.putBits(138 - 11, 7);
+			putLength(18);
+			writer.putBits(20 - 11, 7); // Up to the end of block symbol
+			putLength(1);
+			putLength(17);
+			writer.putBits(zeroesAfterEnd - 3, 3); // Symbol 257 and the first two distance codes if 3
+			putLength(1);
+			writer.putBits(0, 1); // 'a'
+			writer.putBits(1, 1); // End of block
+			writer.alignToByte();
+			return writer.takeCompleteBytes();
+		};
+		std::vector<char> decompressed = readDeflateIntoVector(makeBlock(3));
+		doATest(std::string_view(decompressed.data(), decompressed.size()), "a");
+
+		bool threw = false;
+		try {
+			readDeflateIntoVector(makeBlock(10)); // Runs past the distance codes, though not past the largest possible tables
+		} catch (std::runtime_error&) {
+			threw = true;
+		}
+		doATest(threw, true);
+	}
+
 	std::cout << "Passed: " << (tests - errors) << " / " << tests << ", errors: " << errors << std::endl;
 	return 0;
 }
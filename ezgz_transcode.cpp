@@ -0,0 +1,40 @@
+//usr/bin/g++ --std=c++20 -Wall $0 -O2 -o ${o=`mktemp`} && exec $o $*
+#include "ezgz.hpp"
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+
+// Rewrites a .gz file into BGZF, which remains a valid .gz file, but its parts can be decompressed independently, and writes an index of them
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cout << "Usage: " << argv[0] << " name_of_file_to_transcode.gz name_of_transcoded_file.gz" << std::endl;
+		std::cout << "The index of the blocks is written to a file with the same name with .gzi appended" << std::endl;
+		return 1;
+	}
+
+	std::string inputName = argv[1];
+	std::string outputName = argv[2];
+	ssize_t inputSize = std::filesystem::file_size(inputName);
+
+	EzGz::IGzFile<> input(inputName);
+	std::ofstream output(outputName, std::ios::binary);
+	output.exceptions(std::ifstream::failbit);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	std::vector<EzGz::GzBlockPosition> positions = EzGz::transcodeToIndependentBlocks(input, [&] (std::span<const uint8_t> written) {
+		output.write(reinterpret_cast<const char*>(written.data()), written.size());
+	});
+	output.close();
+	std::vector<uint8_t> index = EzGz::saveGzBlockIndex(positions);
+	std::ofstream indexOutput(outputName + ".gzi", std::ios::binary);
+	indexOutput.exceptions(std::ifstream::failbit);
+	indexOutput.write(reinterpret_cast<const char*>(index.data()), index.size());
+	std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+	std::chrono::microseconds duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
+
+	ssize_t outputSize = std::filesystem::file_size(outputName);
+	std::cout << "Wrote " << positions.size() << " blocks, size changed from " << inputSize << " to " << outputSize << " bytes" << std::endl;
+	std::cout << "Transcoded " << inputSize << " bytes at speed " << ((float(inputSize) / (1024 * 1024)) / (float(duration.count()) / 1000000))
+			<< " MiB/s" << std::endl;
+}